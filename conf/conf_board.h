@@ -8,3 +8,12 @@
 
 // Share the trace pin
 #define ALERT_OUTPUT_PIN DEBUG_ERR
+
+// Open drain /INT outputs of both I/O expanders, wired together on the boards which have the line
+// Those boards read the inputs on it with '#define MUX_USE_INT 1', the others poll the expanders
+#define MUX_INT_PIN IOPORT_CREATE_PIN(PORTB, 2)
+
+// Pins of the TWI on its default route, clocked by hand to clear the bus
+#define I2C_VPORT VPORTB
+#define I2C_SCL_bm PIN0_bm
+#define I2C_SDA_bm PIN1_bm
@@ -0,0 +1,27 @@
+#pragma once
+
+/// Modbus address of the console until one is set through the slave address register
+#define CONSOLE_DEFAULT_ADDRESS 37
+
+/// EEPROM location of the slave address, followed by its complement to tell it was set
+#define CONSOLE_ADDRESS_EEPROM 0
+
+/// Delay before a new line rate is applied, for the acknowledge to go out at the previous rate
+#define CONSOLE_BAUD_SWITCH_MS 5
+
+/// Time given to the master to commit a new line rate, before the previous rate is restored
+#define CONSOLE_BAUD_COMMIT_MS 500
+
+/// Parse the frames once complete (T3.5) rather than as the characters are received
+/// The UART ISR then only stores the character. Set to 0 to parse in the ISR.
+#ifndef CONSOLE_DEFERRED_PARSING
+#  define CONSOLE_DEFERRED_PARSING 1
+#endif
+
+/// Characters of a frame kept aside while the handler of the previous frame is late
+/// A longer frame is dropped. Polls and short requests fit.
+#define CONSOLE_RTU_BACKLOG 16
+
+/// TCB timing the silences on the RS485 line (see src/rtu.cpp), and its interrupt
+#define CONSOLE_RTU_TCB TCB0
+#define CONSOLE_RTU_TCB_vect TCB0_INT_vect
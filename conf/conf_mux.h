@@ -0,0 +1,44 @@
+#pragma once
+
+/// Interval at which the LEDs are rewritten to the expanders even if unchanged (ms)
+#define MUX_LED_REFRESH_MS 500
+
+/// Read the inputs on a change of the expanders /INT line (MUX_INT_PIN) rather than polling
+///  them every 2ms. Only for the boards which wire the line, which set it to 1 in conf_board.h.
+#ifndef MUX_USE_INT
+#  define MUX_USE_INT 0
+#endif
+
+/// Time base of the LED effects (ms)
+#define MUX_EFFECT_TICK_MS 20
+
+/// Time unit of the LED dimming (us). The brightness is modulated by bit angle over 4 slots
+///  of 1, 2, 4 and 8 units, so 500us refreshes at 133Hz.
+#define MUX_DIM_UNIT_US 500
+
+/// Period at which the inputs are sampled after a change, until the keys are stable (us)
+#define MUX_INT_SAMPLE_US 1000
+
+/// Consecutive samples for a key or switch to be seen pressed, then released
+/// Deepen for noisy contacts, at the cost of latency (a sample every 2ms or MUX_INT_SAMPLE_US)
+#define MUX_PRESS_SAMPLES 3
+#define MUX_RELEASE_SAMPLES 3
+
+/// Number of key events kept until the master reads them. The oldest is lost on overflow.
+#define MUX_KEY_EVENTS 16
+
+/// Gestures, reported as key events of their own (0 disables one)
+/// Time a key is held to be a long press (ms), after which it repeats every MUX_REPEAT_MS
+#define MUX_LONG_PRESS_MS 800
+#define MUX_REPEAT_MS 100
+
+/// Longest time from the release of a key to its next press for a double press (ms)
+#define MUX_DOUBLE_PRESS_MS 300
+
+/// Time a key of a chord is held back for the other keys of the chord to join (ms)
+/// The other keys are reported without delay.
+#define MUX_CHORD_MS 30
+
+/// Interval at which an expander out of service after an I2C failure is initialised again (ms)
+/// The other expanders are served meanwhile, the inputs of this one hold their last state.
+#define MUX_RECOVERY_RETRY_MS 20
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "mux_board.hpp"
+
+namespace board {
+   using namespace console::mux;
+
+   /** Expanders of the console. The LEDs are wired from the right, the keys from the left. */
+   struct Panel {
+      static constexpr Expander expanders[] = {
+         {  // Left
+            0,
+            { led(6), led(7), led(8), led(9), led(10), led(11), none(), none() },
+            { key(0), key(1), key(2), key(3), key(4), key(5), none(), none() }
+         },
+         {  // Right, with the override switches flipped as they are active low
+            1,
+            { led(0), led(1), led(2), led(3), led(4), led(5), none(), none() },
+            { switch_(0, true), switch_(1, true), switch_(2, true), switch_(3, true), key(6), shift(), none(), none() }
+         },
+      };
+
+      /** Chords, reported after the shifted keys: Homing + Goto0, then Park + Chuck */
+      static constexpr uint16_t chords[] = { chord({2, 3}), chord({4, 5}) };
+   };
+}
@@ -1,4 +1,4 @@
 #pragma once
 
-#define PIEZZO_PRIO reactor_prio_high
+/// Timer sounding the piezzo, in split mode on its WO3 output (see src/piezzo.cpp)
 #define PIEZZO_TCA TCA0
@@ -1,9 +1,64 @@
-#!/usr/bin/env python3
+# REFERENCE ONLY - this file is not a generator input any more, do not run it
+# It documents the frames served by the console and the register map. conf/datagram.hpp, which
+#  implements them, is maintained by hand: the 'conf/datagram.hpp : ;' rule of the Makefile keeps
+#  the build from generating it from here. modbus_rtu_rc does not support payload, DIAGNOSTICS,
+#  READ_FIFO_QUEUE and READ_WRITE_MULTIPLE_REGISTERS used below, nor the frame sizes, so running
+#  it would overwrite the header with one missing them.
+# A change to the frames is made in conf/datagram.hpp first, then recorded here.
 from modbus_rtu_rc import *  # Import everything from modbus_generator
 
+# Custom function replying once the inputs change, or on timeout
+WAIT_FOR_CHANGE = CUSTOM + 1
+
 # Coils = LED+ (write multiple only)
 # Discrete inputs = Switch state
-# Input register = Active key
+# Input registers = Active key, then the diagnostics counters (see src/diagnostics.hpp)
+#  0 : Active key
+#  1 : Frames received       2 : Frames for other nodes    3 : Frames with a bad CRC
+#  4 : Exceptions replied    5 : I2C transfers             6 : I2C errors
+#  7 : Max poll lateness (us), 8-15 : Histogram of the poll lateness, from 64us doubling
+# 16 : Max turnaround from the T3.5 ending a request (us), 17-24 : Histogram of the turnaround, from 16us doubling
+# 25- : I2C errors of each expander, then the times each expander was put back in service, a
+#       register each per expander of the board (see conf/conf_mux_board.hpp), so 25-26 and
+#       27-28 for the 2 expanders of the panel. Declared for up to 8 expanders, up to 40: the
+#       registers beyond the board are refused with an illegal data address.
+# Diagnostics (08) = 0x00 echo, 0x0A clear the counters, 0x0B frames, 0x0C bad CRC, 0x0D exceptions
+# FIFO queue 0 = Key events <seq=8> <code=8> <ms=16>, the code is a key (see Keys) with flags
+#  0x80 pressed, and the kind of event in 0x60: 0x00 press or release, 0x20 long press,
+#  0x40 repeat while held after a long press, 0x60 double press (see conf_mux.h for the times)
+# Holding registers = Image of the console state (see src/registers.hpp)
+#  0-9 : Reserved, read 0
+# 10 : Buzzer, write 0 to stop, 1-3 to beep, 4 to play the uploaded tune (W). Reads 99, as it
+#      always has.
+# 11 : LEDs (R/W), next to the buzzer so a write of 10-11 sets both
+# 12 : LED writes issued to the expanders
+# 13 : LED writes skipped: an update of the LEDs (LED word, effect tick or dimming slot) left
+#      an expander as it was. The refresh every 500ms is not counted.
+# 14 : Active key
+# 15 : Switches
+# 16 : Status (0x1 key events pending, 0x2 key events lost, 0x4 line rate on trial,
+#      0x8 initialising, the key and switches are not read yet,
+#      0x10 I2C fault, an expander is out of service: its inputs hold their last state and its
+#      LEDs are not driven until it is initialised again)
+# 17 : Change sequence
+# 18-29 : Effect of each LED (R/W), in ticks of 20ms
+#         0x0000 steady, 0x4000 | period << 7 | phase blink,
+#         0x8000 | duration flash, 0xC000 | step << 8 | pattern
+# 30-41 : Brightness of each LED (R/W), 0 (off) to 15 (full)
+# 42 : Tempo of the uploaded tune (R/W), in beats per minute
+# 43-74 : Uploaded tune (R/W), a note per register <pitch=8> <beats=8>
+#         pitch is the MIDI note (0 rest), its MSB slurs into the next note. 0 beats ends the tune.
+# 75 : Slave address (R/W), 1-247, kept in EEPROM. The reply comes from the previous address.
+# 76 : Line rate (R/W), 0 115200, 1 230400, 2 460800, 3 1Mbaud. The reply comes at the previous
+#      rate. Write the same value again at the new rate to commit it, or the previous rate is
+#      restored after CONSOLE_BAUD_COMMIT_MS.
+# 77 : Time from the start to the first read of the inputs (us), once the status is no longer
+#      initialising. The requests are served from the start.
+#
+# Broadcast (address 0)
+# --------------
+# The write functions (05, 06, 15, 16) are applied, and never replied. The slave address is not,
+#  as all the consoles of the line would take it.
 
 # Keys
 # --------------
@@ -22,6 +77,8 @@ from modbus_rtu_rc import *  # Import everything from modbus_generator
 # 12 : Shift + Park
 # 13 : Shift + Chuck
 # 14 : Shift + Door
+# 15 : Homing + Goto0 held together
+# 16 : Park + Chuck held together
 
 # Switches
 # --------------
@@ -45,8 +102,9 @@ from modbus_rtu_rc import *  # Import everything from modbus_generator
 # 0x1000 Door
 # 0x2000 Shift
 
+# The buffer is sized for the largest frame declared below (see frame_sizes in datagram.hpp), so
+#  the quantities are bound to the registers of the console rather than to the Modbus limits
 Modbus({
-    "buffer_size": 255,
     "namespace": "console",
 
     "callbacks": {
@@ -54,13 +112,19 @@ Modbus({
         "on_read_leds"     : [(u8, "addr"), (u8, "qty")],
         "on_write_leds_8"  : [(u8, "addr"), (u8, "qty"), (u8), (u8, "data")],
         "on_write_leds_12" : [(u8, "addr"), (u8, "qty"), (u8), (u16, "data")],
-        "on_get_active_key": [],
+        "on_read_input_registers": [(u16, "from"), (u16, "qty")],
+        "on_diagnostics"   : [(u16, "sub_function"), (u16, "data")],
         "on_write_holding" : [(u16), (u16)],
         "on_custom"        : [(u16, "leds")],
+        "on_wait_for_change" : [(u16, "leds"), (u8, "sequence"), (u8, "timeout")],
         "on_write_single_led" : [(u8, "index"), (u16, "value")],
         "on_read_holding"  : [(u16), (u16)],
+        "on_read_key_events" : [(u16, "pointer")],
+        "on_read_write_registers" : [(u16, "read_from"), (u16, "read_qty"), (u16, "write_from"), (u16, "write_qty"), (u8, "bytecount"), (payload, "values")],
+        "on_write_registers" : [(u16, "from"), (u16, "qty"), (u8, "bytecount"), (payload, "values")],
     },
 
+    # The address is the default one, it is matched at runtime (see CONSOLE_DEFAULT_ADDRESS)
     "device@37": [
         # Read the push button and switches state
         (READ_DISCRETE_INPUTS,  u16(0, 3, alias="from"),
@@ -87,15 +151,51 @@ Modbus({
                                 u16(alias="data"),
                                 "on_write_leds_12"),
 
-        # Returns the active key
-        (READ_INPUT_REGISTERS,  u16(0, alias="from"),
-                                u16(1, alias="qty"),
-                                "on_get_active_key"),
+        # Returns the active key and the diagnostics counters
+        (READ_INPUT_REGISTERS,  u16(0, 40, alias="from"),
+                                u16(1, 31, alias="qty"),
+                                "on_read_input_registers"),
+
+        # Read or clear the counters
+        (DIAGNOSTICS,           u16(0, 0x0d, alias="sub_function"),
+                                u16(alias="data"),
+                                "on_diagnostics"),
+
+        # Up to the 78 holding registers (see src/registers.hpp)
+        (READ_HOLDING_REGISTERS, u16(), u16(1,78), "on_read_holding"),
+
+        # Write the buzzer and the LEDs (10-11), then read back the inputs and status in one frame
+        (READ_WRITE_MULTIPLE_REGISTERS,
+                                u16(alias="read_from"),
+                                u16(1, 78, alias="read_qty"),
+                                u16(alias="write_from"),
+                                u16(1, 78, alias="write_qty"),
+                                u8(2, 156, alias="bytecount"),
+                                payload(alias="values"),
+                                "on_read_write_registers"),
 
-        (READ_HOLDING_REGISTERS, u16(), u16(1,125), "on_read_holding"),
+        # Write a block of registers, like uploading a tune
+        (WRITE_MULTIPLE_REGISTERS,
+                                u16(alias="from"),
+                                u16(1, 78, alias="qty"),
+                                u8(2, 156, alias="bytecount"),
+                                payload(alias="values"),
+                                "on_write_registers"),
 
         (WRITE_SINGLE_REGISTER, u16(), u16(), "on_write_holding"),
 
+        # Poll: replies <sw=8> <key=8> <flags=8>, the flags being the initialising (0x8) and
+        #  I2C fault (0x10) bits of the status
         (CUSTOM,                u16(alias="leds"), "on_custom"),
+
+        # Long poll: the reply is deferred until the inputs change or the timeout (x10ms)
+        #  It replies <sequence=8> <sw=8> <key=8> <flags=8>
+        (WAIT_FOR_CHANGE,       u16(alias="leds"),
+                                u8(alias="sequence"),
+                                u8(1, 255, alias="timeout"),
+                                "on_wait_for_change"),
+
+        # Drain the key events
+        (READ_FIFO_QUEUE,       u16(0, alias="pointer"), "on_read_key_events"),
     ]
 })
@@ -1,12 +1,18 @@
 #pragma once
 /**
- * This file was generated to create a state machine for processing
- * uart data used for a modbus RTU. It should be included by
- * the modbus_rtu_slave.cpp file only which will create a full rtu slave device.
+ * State machine processing the uart data of the modbus RTU slave of the console.
+ * It should be included by the modbus_rtu_slave.cpp file only which will create a full rtu slave device.
+ * This file is maintained by hand. It started as the output of the modbus_rtu_rc generator, which
+ *  does not support the payload fields, the diagnostics, FIFO and read/write functions nor the
+ *  frame sizes declared here. conf/datagram.conf.py declares the same frames, as their reference.
  */
 #include <stdint.h>
+#include <string.h>
 #include <trace.h>
 #include <asx/modbus_rtu.hpp>
+#include "conf_console.h"
+#include "crc.hpp"
+#include "diagnostics.hpp"
 
 namespace console {
     // All callbacks registered
@@ -14,38 +20,338 @@ namespace console {
     void on_read_leds(uint8_t addr, uint8_t qty);
     void on_write_leds_8(uint8_t addr, uint8_t qty, uint8_t, uint8_t data);
     void on_write_leds_12(uint8_t addr, uint8_t qty, uint8_t, uint16_t data);
-    void on_get_active_key();
+    void on_read_input_registers(uint16_t from, uint16_t qty);
     void on_write_holding(uint16_t, uint16_t);
     void on_custom(uint16_t leds);
     void on_write_single_led(uint8_t index, uint16_t value);
     void on_read_holding(uint16_t, uint16_t);
+    void on_read_key_events(uint16_t pointer);
+    void on_wait_for_change(uint16_t leds, uint8_t sequence, uint8_t timeout);
+    void on_read_write_registers(uint16_t read_from, uint16_t read_qty, uint16_t write_from, uint16_t write_qty, uint8_t bytecount, const uint8_t *values, uint8_t size);
+    void on_write_registers(uint16_t from, uint16_t qty, uint8_t bytecount, const uint8_t *values, uint8_t size);
+    void on_diagnostics(uint16_t sub_function, uint16_t data);
 
     // All states to consider
     enum class state_t : uint8_t {
         IGNORE = 0,
-        ERROR = 1,
-        DEVICE_ADDRESS,
+        ILLEGAL_FUNCTION = 1,
+        ILLEGAL_DATA_ADDRESS = 2,
+        ILLEGAL_DATA_VALUE = 3,
+        DEVICE_ADDRESS = 4,
         DEVICE_37,
+        DEVICE_37__OR_1,
+        DEVICE_37__OR_2,
+        DEVICE_37__OR_3,
+        DEVICE_37__OR_4,
+        DEVICE_37__OR_5,
+        DEVICE_37__OR_6,
+        DEVICE_37__OR_7,
+        DEVICE_37__OR_8,
+        DEVICE_37__OR_9,
+        DEVICE_37__OR_10,
+        DEVICE_37__OR_11,
+        DEVICE_37__OR_12,
         DEVICE_37_CUSTOM,
+        DEVICE_37_CUSTOM__LEDS_HI,
+        DEVICE_37_CUSTOM__LEDS,
         DEVICE_37_CUSTOM__ON_CUSTOM__CRC,
-        RDY_TO_CALL__ON_CUSTOM
+        DEVICE_37_WAIT_FOR_CHANGE,
+        DEVICE_37_WAIT_FOR_CHANGE__LEDS_HI,
+        DEVICE_37_WAIT_FOR_CHANGE__LEDS,
+        DEVICE_37_WAIT_FOR_CHANGE__SEQUENCE,
+        DEVICE_37_WAIT_FOR_CHANGE__TIMEOUT,
+        DEVICE_37_WAIT_FOR_CHANGE__ON_WAIT_FOR_CHANGE__CRC,
+        DEVICE_37_READ_FIFO_QUEUE,
+        DEVICE_37_READ_FIFO_QUEUE__POINTER_HI,
+        DEVICE_37_READ_FIFO_QUEUE__POINTER,
+        DEVICE_37_READ_FIFO_QUEUE__ON_READ_KEY_EVENTS__CRC,
+        DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS,
+        DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__READ_FROM_HI,
+        DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__READ_FROM,
+        DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__READ_QTY_HI,
+        DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__READ_QTY,
+        DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__WRITE_FROM_HI,
+        DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__WRITE_FROM,
+        DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__WRITE_QTY_HI,
+        DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__WRITE_QTY,
+        DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__BYTECOUNT,
+        DEVICE_37_WRITE_MULTIPLE_REGISTERS,
+        DEVICE_37_WRITE_MULTIPLE_REGISTERS__FROM_HI,
+        DEVICE_37_WRITE_MULTIPLE_REGISTERS__FROM,
+        DEVICE_37_WRITE_MULTIPLE_REGISTERS__QTY_HI,
+        DEVICE_37_WRITE_MULTIPLE_REGISTERS__QTY,
+        DEVICE_37_WRITE_MULTIPLE_REGISTERS__BYTECOUNT,
+        DEVICE_37_READ_COILS,
+        DEVICE_37_READ_COILS__FROM_HI,
+        DEVICE_37_READ_COILS__FROM,
+        DEVICE_37_READ_COILS__QTY_HI,
+        DEVICE_37_READ_COILS__QTY,
+        DEVICE_37_READ_COILS__ON_READ_LEDS__CRC,
+        DEVICE_37_WRITE_MULTIPLE_COILS,
+        DEVICE_37_WRITE_MULTIPLE_COILS__START_HI,
+        DEVICE_37_WRITE_MULTIPLE_COILS__START,
+        DEVICE_37_WRITE_MULTIPLE_COILS__QTY_HI,
+        DEVICE_37_WRITE_MULTIPLE_COILS__QTY_HI__OR_1,
+        DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_8__QTY,
+        DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_8__BYTECOUNT,
+        DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_8__DATA,
+        DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_8__CRC,
+        DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_12__QTY,
+        DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_12__BYTECOUNT,
+        DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_12__DATA_HI,
+        DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_12__DATA,
+        DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_12__CRC,
+        DEVICE_37_READ_DISCRETE_INPUTS,
+        DEVICE_37_READ_DISCRETE_INPUTS__FROM_HI,
+        DEVICE_37_READ_DISCRETE_INPUTS__FROM,
+        DEVICE_37_READ_DISCRETE_INPUTS__QTY_HI,
+        DEVICE_37_READ_DISCRETE_INPUTS__QTY,
+        DEVICE_37_READ_DISCRETE_INPUTS__ON_GET_SW_STATUS__CRC,
+        DEVICE_37_READ_INPUT_REGISTERS,
+        DEVICE_37_READ_INPUT_REGISTERS__FROM_HI,
+        DEVICE_37_READ_INPUT_REGISTERS__FROM,
+        DEVICE_37_READ_INPUT_REGISTERS__QTY_HI,
+        DEVICE_37_READ_INPUT_REGISTERS__QTY,
+        DEVICE_37_READ_INPUT_REGISTERS__ON_READ_INPUT_REGISTERS__CRC,
+        DEVICE_37_DIAGNOSTICS,
+        DEVICE_37_DIAGNOSTICS__SUB_FUNCTION_HI,
+        DEVICE_37_DIAGNOSTICS__SUB_FUNCTION,
+        DEVICE_37_DIAGNOSTICS__DATA_HI,
+        DEVICE_37_DIAGNOSTICS__DATA,
+        DEVICE_37_DIAGNOSTICS__ON_DIAGNOSTICS__CRC,
+        DEVICE_37_WRITE_SINGLE_COIL,
+        DEVICE_37_WRITE_SINGLE_COIL__FROM_HI,
+        DEVICE_37_WRITE_SINGLE_COIL__FROM,
+        DEVICE_37_WRITE_SINGLE_COIL__FROM__OR_1,
+        DEVICE_37_WRITE_SINGLE_COIL__QTY_HI,
+        DEVICE_37_WRITE_SINGLE_COIL__QTY,
+        DEVICE_37_WRITE_SINGLE_COIL__ON_WRITE_SINGLE_LED__CRC,
+        DEVICE_37_READ_HOLDING_REGISTERS,
+        DEVICE_37_READ_HOLDING_REGISTERS__ADDR_HI,
+        DEVICE_37_READ_HOLDING_REGISTERS__ADDR,
+        DEVICE_37_READ_HOLDING_REGISTERS__QTY_HI,
+        DEVICE_37_READ_HOLDING_REGISTERS__QTY,
+        DEVICE_37_READ_HOLDING_REGISTERS__ON_READ_HOLDING__CRC,
+        DEVICE_37_WRITE_SINGLE_REGISTER,
+        DEVICE_37_WRITE_SINGLE_REGISTER__ADDR_HI,
+        DEVICE_37_WRITE_SINGLE_REGISTER__ADDR,
+        DEVICE_37_WRITE_SINGLE_REGISTER__VALUE_HI,
+        DEVICE_37_WRITE_SINGLE_REGISTER__VALUE,
+        DEVICE_37_WRITE_SINGLE_REGISTER__ON_WRITE_HOLDING__CRC,
+        RDY_TO_CALL__ON_CUSTOM,
+        RDY_TO_CALL__ON_WAIT_FOR_CHANGE,
+        RDY_TO_CALL__ON_READ_KEY_EVENTS,
+        RDY_TO_CALL__ON_READ_WRITE_REGISTERS,
+        RDY_TO_CALL__ON_WRITE_REGISTERS,
+        RDY_TO_CALL__ON_READ_LEDS,
+        RDY_TO_CALL__ON_WRITE_LEDS_8,
+        RDY_TO_CALL__ON_WRITE_LEDS_12,
+        RDY_TO_CALL__ON_GET_SW_STATUS,
+        RDY_TO_CALL__ON_READ_INPUT_REGISTERS,
+        RDY_TO_CALL__ON_DIAGNOSTICS,
+        RDY_TO_CALL__ON_WRITE_SINGLE_LED,
+        RDY_TO_CALL__ON_READ_HOLDING,
+        RDY_TO_CALL__ON_WRITE_HOLDING,
     };
 
+    /**
+     * One transition per byte position, flattened in a table which stays in flash.
+     * A rejected byte tries the alternative transition, or ends in the error state
+     *  given as the alternative. Alternatives are ordered by expected frequency.
+     * A variable payload loops on its ready state until the end of the frame.
+     */
+    struct transition_t {
+        uint8_t min;   ///< Lowest value accepted
+        uint8_t max;   ///< Highest value accepted
+        state_t next;  ///< State once the byte is accepted
+        state_t other; ///< Alternative transition, or error state
+    };
+
+    ///< All transitions, indexed from DEVICE_37
+    ///< The address has no row: it is matched at runtime (see match_address), DEVICE_37 standing
+    ///<  for whatever address the console answers to.
+    inline constexpr transition_t transitions[] = {
+        { 101, 101, state_t::DEVICE_37_CUSTOM,                                              state_t::DEVICE_37__OR_1 }, // DEVICE_37
+        { 102, 102, state_t::DEVICE_37_WAIT_FOR_CHANGE,                                     state_t::DEVICE_37__OR_2 }, // DEVICE_37__OR_1
+        {  24,  24, state_t::DEVICE_37_READ_FIFO_QUEUE,                                     state_t::DEVICE_37__OR_3 }, // DEVICE_37__OR_2
+        {  23,  23, state_t::DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS,                       state_t::DEVICE_37__OR_4 }, // DEVICE_37__OR_3
+        {  16,  16, state_t::DEVICE_37_WRITE_MULTIPLE_REGISTERS,                            state_t::DEVICE_37__OR_5 }, // DEVICE_37__OR_4
+        {   1,   1, state_t::DEVICE_37_READ_COILS,                                          state_t::DEVICE_37__OR_6 }, // DEVICE_37__OR_5
+        {  15,  15, state_t::DEVICE_37_WRITE_MULTIPLE_COILS,                                state_t::DEVICE_37__OR_7 }, // DEVICE_37__OR_6
+        {   2,   2, state_t::DEVICE_37_READ_DISCRETE_INPUTS,                                state_t::DEVICE_37__OR_8 }, // DEVICE_37__OR_7
+        {   4,   4, state_t::DEVICE_37_READ_INPUT_REGISTERS,                                state_t::DEVICE_37__OR_9 }, // DEVICE_37__OR_8
+        {   8,   8, state_t::DEVICE_37_DIAGNOSTICS,                                         state_t::DEVICE_37__OR_10 }, // DEVICE_37__OR_9
+        {   5,   5, state_t::DEVICE_37_WRITE_SINGLE_COIL,                                   state_t::DEVICE_37__OR_11 }, // DEVICE_37__OR_10
+        {   3,   3, state_t::DEVICE_37_READ_HOLDING_REGISTERS,                              state_t::DEVICE_37__OR_12 }, // DEVICE_37__OR_11
+        {   6,   6, state_t::DEVICE_37_WRITE_SINGLE_REGISTER,                               state_t::ILLEGAL_FUNCTION }, // DEVICE_37__OR_12
+        {   0, 255, state_t::DEVICE_37_CUSTOM__LEDS_HI,                                     state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_CUSTOM
+        {   0, 255, state_t::DEVICE_37_CUSTOM__LEDS,                                        state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_CUSTOM__LEDS_HI
+        {   0, 255, state_t::DEVICE_37_CUSTOM__ON_CUSTOM__CRC,                              state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_CUSTOM__LEDS
+        {   0, 255, state_t::RDY_TO_CALL__ON_CUSTOM,                                        state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_CUSTOM__ON_CUSTOM__CRC
+        {   0, 255, state_t::DEVICE_37_WAIT_FOR_CHANGE__LEDS_HI,                            state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WAIT_FOR_CHANGE
+        {   0, 255, state_t::DEVICE_37_WAIT_FOR_CHANGE__LEDS,                               state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WAIT_FOR_CHANGE__LEDS_HI
+        {   0, 255, state_t::DEVICE_37_WAIT_FOR_CHANGE__SEQUENCE,                           state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WAIT_FOR_CHANGE__LEDS
+        {   1, 255, state_t::DEVICE_37_WAIT_FOR_CHANGE__TIMEOUT,                            state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WAIT_FOR_CHANGE__SEQUENCE
+        {   0, 255, state_t::DEVICE_37_WAIT_FOR_CHANGE__ON_WAIT_FOR_CHANGE__CRC,            state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WAIT_FOR_CHANGE__TIMEOUT
+        {   0, 255, state_t::RDY_TO_CALL__ON_WAIT_FOR_CHANGE,                               state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WAIT_FOR_CHANGE__ON_WAIT_FOR_CHANGE__CRC
+        {   0,   0, state_t::DEVICE_37_READ_FIFO_QUEUE__POINTER_HI,                         state_t::ILLEGAL_DATA_ADDRESS }, // DEVICE_37_READ_FIFO_QUEUE
+        {   0,   0, state_t::DEVICE_37_READ_FIFO_QUEUE__POINTER,                            state_t::ILLEGAL_DATA_ADDRESS }, // DEVICE_37_READ_FIFO_QUEUE__POINTER_HI
+        {   0, 255, state_t::DEVICE_37_READ_FIFO_QUEUE__ON_READ_KEY_EVENTS__CRC,            state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_READ_FIFO_QUEUE__POINTER
+        {   0, 255, state_t::RDY_TO_CALL__ON_READ_KEY_EVENTS,                               state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_READ_FIFO_QUEUE__ON_READ_KEY_EVENTS__CRC
+        {   0, 255, state_t::DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__READ_FROM_HI,         state_t::ILLEGAL_DATA_ADDRESS }, // DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS
+        {   0, 255, state_t::DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__READ_FROM,            state_t::ILLEGAL_DATA_ADDRESS }, // DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__READ_FROM_HI
+        {   0,   0, state_t::DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__READ_QTY_HI,          state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__READ_FROM
+        {   1,  78, state_t::DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__READ_QTY,             state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__READ_QTY_HI
+        {   0, 255, state_t::DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__WRITE_FROM_HI,        state_t::ILLEGAL_DATA_ADDRESS }, // DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__READ_QTY
+        {   0, 255, state_t::DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__WRITE_FROM,           state_t::ILLEGAL_DATA_ADDRESS }, // DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__WRITE_FROM_HI
+        {   0,   0, state_t::DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__WRITE_QTY_HI,         state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__WRITE_FROM
+        {   1,  78, state_t::DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__WRITE_QTY,            state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__WRITE_QTY_HI
+        {   2, 156, state_t::DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__BYTECOUNT,            state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__WRITE_QTY
+        {   0, 255, state_t::RDY_TO_CALL__ON_READ_WRITE_REGISTERS,                          state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_READ_WRITE_MULTIPLE_REGISTERS__BYTECOUNT
+        {   0, 255, state_t::DEVICE_37_WRITE_MULTIPLE_REGISTERS__FROM_HI,                   state_t::ILLEGAL_DATA_ADDRESS }, // DEVICE_37_WRITE_MULTIPLE_REGISTERS
+        {   0, 255, state_t::DEVICE_37_WRITE_MULTIPLE_REGISTERS__FROM,                      state_t::ILLEGAL_DATA_ADDRESS }, // DEVICE_37_WRITE_MULTIPLE_REGISTERS__FROM_HI
+        {   0,   0, state_t::DEVICE_37_WRITE_MULTIPLE_REGISTERS__QTY_HI,                    state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WRITE_MULTIPLE_REGISTERS__FROM
+        {   1,  78, state_t::DEVICE_37_WRITE_MULTIPLE_REGISTERS__QTY,                       state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WRITE_MULTIPLE_REGISTERS__QTY_HI
+        {   2, 156, state_t::DEVICE_37_WRITE_MULTIPLE_REGISTERS__BYTECOUNT,                 state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WRITE_MULTIPLE_REGISTERS__QTY
+        {   0, 255, state_t::RDY_TO_CALL__ON_WRITE_REGISTERS,                               state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WRITE_MULTIPLE_REGISTERS__BYTECOUNT
+        {   0,   0, state_t::DEVICE_37_READ_COILS__FROM_HI,                                 state_t::ILLEGAL_DATA_ADDRESS }, // DEVICE_37_READ_COILS
+        {   0,  11, state_t::DEVICE_37_READ_COILS__FROM,                                    state_t::ILLEGAL_DATA_ADDRESS }, // DEVICE_37_READ_COILS__FROM_HI
+        {   0,   0, state_t::DEVICE_37_READ_COILS__QTY_HI,                                  state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_READ_COILS__FROM
+        {   1,  12, state_t::DEVICE_37_READ_COILS__QTY,                                     state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_READ_COILS__QTY_HI
+        {   0, 255, state_t::DEVICE_37_READ_COILS__ON_READ_LEDS__CRC,                       state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_READ_COILS__QTY
+        {   0, 255, state_t::RDY_TO_CALL__ON_READ_LEDS,                                     state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_READ_COILS__ON_READ_LEDS__CRC
+        {   0,   0, state_t::DEVICE_37_WRITE_MULTIPLE_COILS__START_HI,                      state_t::ILLEGAL_DATA_ADDRESS }, // DEVICE_37_WRITE_MULTIPLE_COILS
+        {   0,  11, state_t::DEVICE_37_WRITE_MULTIPLE_COILS__START,                         state_t::ILLEGAL_DATA_ADDRESS }, // DEVICE_37_WRITE_MULTIPLE_COILS__START_HI
+        {   0,   0, state_t::DEVICE_37_WRITE_MULTIPLE_COILS__QTY_HI,                        state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WRITE_MULTIPLE_COILS__START
+        {   1,   8, state_t::DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_8__QTY,          state_t::DEVICE_37_WRITE_MULTIPLE_COILS__QTY_HI__OR_1 }, // DEVICE_37_WRITE_MULTIPLE_COILS__QTY_HI
+        {   9,  12, state_t::DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_12__QTY,         state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WRITE_MULTIPLE_COILS__QTY_HI__OR_1
+        {   1,   1, state_t::DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_8__BYTECOUNT,    state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_8__QTY
+        {   0, 255, state_t::DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_8__DATA,         state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_8__BYTECOUNT
+        {   0, 255, state_t::DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_8__CRC,          state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_8__DATA
+        {   0, 255, state_t::RDY_TO_CALL__ON_WRITE_LEDS_8,                                  state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_8__CRC
+        {   2,   2, state_t::DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_12__BYTECOUNT,   state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_12__QTY
+        {   0, 255, state_t::DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_12__DATA_HI,     state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_12__BYTECOUNT
+        {   0, 255, state_t::DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_12__DATA,        state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_12__DATA_HI
+        {   0, 255, state_t::DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_12__CRC,         state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_12__DATA
+        {   0, 255, state_t::RDY_TO_CALL__ON_WRITE_LEDS_12,                                 state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WRITE_MULTIPLE_COILS__ON_WRITE_LEDS_12__CRC
+        {   0,   0, state_t::DEVICE_37_READ_DISCRETE_INPUTS__FROM_HI,                       state_t::ILLEGAL_DATA_ADDRESS }, // DEVICE_37_READ_DISCRETE_INPUTS
+        {   0,   3, state_t::DEVICE_37_READ_DISCRETE_INPUTS__FROM,                          state_t::ILLEGAL_DATA_ADDRESS }, // DEVICE_37_READ_DISCRETE_INPUTS__FROM_HI
+        {   0,   0, state_t::DEVICE_37_READ_DISCRETE_INPUTS__QTY_HI,                        state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_READ_DISCRETE_INPUTS__FROM
+        {   1,   4, state_t::DEVICE_37_READ_DISCRETE_INPUTS__QTY,                           state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_READ_DISCRETE_INPUTS__QTY_HI
+        {   0, 255, state_t::DEVICE_37_READ_DISCRETE_INPUTS__ON_GET_SW_STATUS__CRC,         state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_READ_DISCRETE_INPUTS__QTY
+        {   0, 255, state_t::RDY_TO_CALL__ON_GET_SW_STATUS,                                 state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_READ_DISCRETE_INPUTS__ON_GET_SW_STATUS__CRC
+        {   0,   0, state_t::DEVICE_37_READ_INPUT_REGISTERS__FROM_HI,                       state_t::ILLEGAL_DATA_ADDRESS }, // DEVICE_37_READ_INPUT_REGISTERS
+        {   0,  40, state_t::DEVICE_37_READ_INPUT_REGISTERS__FROM,                          state_t::ILLEGAL_DATA_ADDRESS }, // DEVICE_37_READ_INPUT_REGISTERS__FROM_HI
+        {   0,   0, state_t::DEVICE_37_READ_INPUT_REGISTERS__QTY_HI,                        state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_READ_INPUT_REGISTERS__FROM
+        {   1,  31, state_t::DEVICE_37_READ_INPUT_REGISTERS__QTY,                           state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_READ_INPUT_REGISTERS__QTY_HI
+        {   0, 255, state_t::DEVICE_37_READ_INPUT_REGISTERS__ON_READ_INPUT_REGISTERS__CRC,  state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_READ_INPUT_REGISTERS__QTY
+        {   0, 255, state_t::RDY_TO_CALL__ON_READ_INPUT_REGISTERS,                          state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_READ_INPUT_REGISTERS__ON_READ_INPUT_REGISTERS__CRC
+        {   0,   0, state_t::DEVICE_37_DIAGNOSTICS__SUB_FUNCTION_HI,                        state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_DIAGNOSTICS
+        {   0,  13, state_t::DEVICE_37_DIAGNOSTICS__SUB_FUNCTION,                           state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_DIAGNOSTICS__SUB_FUNCTION_HI
+        {   0, 255, state_t::DEVICE_37_DIAGNOSTICS__DATA_HI,                                state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_DIAGNOSTICS__SUB_FUNCTION
+        {   0, 255, state_t::DEVICE_37_DIAGNOSTICS__DATA,                                   state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_DIAGNOSTICS__DATA_HI
+        {   0, 255, state_t::DEVICE_37_DIAGNOSTICS__ON_DIAGNOSTICS__CRC,                    state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_DIAGNOSTICS__DATA
+        {   0, 255, state_t::RDY_TO_CALL__ON_DIAGNOSTICS,                                   state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_DIAGNOSTICS__ON_DIAGNOSTICS__CRC
+        {   0,   0, state_t::DEVICE_37_WRITE_SINGLE_COIL__FROM_HI,                          state_t::ILLEGAL_DATA_ADDRESS }, // DEVICE_37_WRITE_SINGLE_COIL
+        {   0,  11, state_t::DEVICE_37_WRITE_SINGLE_COIL__FROM,                             state_t::ILLEGAL_DATA_ADDRESS }, // DEVICE_37_WRITE_SINGLE_COIL__FROM_HI
+        { 255, 255, state_t::DEVICE_37_WRITE_SINGLE_COIL__QTY_HI,                           state_t::DEVICE_37_WRITE_SINGLE_COIL__FROM__OR_1 }, // DEVICE_37_WRITE_SINGLE_COIL__FROM
+        {   0,   0, state_t::DEVICE_37_WRITE_SINGLE_COIL__QTY_HI,                           state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WRITE_SINGLE_COIL__FROM__OR_1
+        {   0,   0, state_t::DEVICE_37_WRITE_SINGLE_COIL__QTY,                              state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WRITE_SINGLE_COIL__QTY_HI
+        {   0, 255, state_t::DEVICE_37_WRITE_SINGLE_COIL__ON_WRITE_SINGLE_LED__CRC,         state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WRITE_SINGLE_COIL__QTY
+        {   0, 255, state_t::RDY_TO_CALL__ON_WRITE_SINGLE_LED,                              state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WRITE_SINGLE_COIL__ON_WRITE_SINGLE_LED__CRC
+        {   0, 255, state_t::DEVICE_37_READ_HOLDING_REGISTERS__ADDR_HI,                     state_t::ILLEGAL_DATA_ADDRESS }, // DEVICE_37_READ_HOLDING_REGISTERS
+        {   0, 255, state_t::DEVICE_37_READ_HOLDING_REGISTERS__ADDR,                        state_t::ILLEGAL_DATA_ADDRESS }, // DEVICE_37_READ_HOLDING_REGISTERS__ADDR_HI
+        {   0,   0, state_t::DEVICE_37_READ_HOLDING_REGISTERS__QTY_HI,                      state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_READ_HOLDING_REGISTERS__ADDR
+        {   1,  78, state_t::DEVICE_37_READ_HOLDING_REGISTERS__QTY,                         state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_READ_HOLDING_REGISTERS__QTY_HI
+        {   0, 255, state_t::DEVICE_37_READ_HOLDING_REGISTERS__ON_READ_HOLDING__CRC,        state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_READ_HOLDING_REGISTERS__QTY
+        {   0, 255, state_t::RDY_TO_CALL__ON_READ_HOLDING,                                  state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_READ_HOLDING_REGISTERS__ON_READ_HOLDING__CRC
+        {   0, 255, state_t::DEVICE_37_WRITE_SINGLE_REGISTER__ADDR_HI,                      state_t::ILLEGAL_DATA_ADDRESS }, // DEVICE_37_WRITE_SINGLE_REGISTER
+        {   0, 255, state_t::DEVICE_37_WRITE_SINGLE_REGISTER__ADDR,                         state_t::ILLEGAL_DATA_ADDRESS }, // DEVICE_37_WRITE_SINGLE_REGISTER__ADDR_HI
+        {   0, 255, state_t::DEVICE_37_WRITE_SINGLE_REGISTER__VALUE_HI,                     state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WRITE_SINGLE_REGISTER__ADDR
+        {   0, 255, state_t::DEVICE_37_WRITE_SINGLE_REGISTER__VALUE,                        state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WRITE_SINGLE_REGISTER__VALUE_HI
+        {   0, 255, state_t::DEVICE_37_WRITE_SINGLE_REGISTER__ON_WRITE_HOLDING__CRC,        state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WRITE_SINGLE_REGISTER__VALUE
+        {   0, 255, state_t::RDY_TO_CALL__ON_WRITE_HOLDING,                                 state_t::ILLEGAL_DATA_VALUE }, // DEVICE_37_WRITE_SINGLE_REGISTER__ON_WRITE_HOLDING__CRC
+        {   1,   0, state_t::ILLEGAL_DATA_VALUE,                                            state_t::ILLEGAL_DATA_VALUE }, // RDY_TO_CALL__ON_CUSTOM
+        {   1,   0, state_t::ILLEGAL_DATA_VALUE,                                            state_t::ILLEGAL_DATA_VALUE }, // RDY_TO_CALL__ON_WAIT_FOR_CHANGE
+        {   1,   0, state_t::ILLEGAL_DATA_VALUE,                                            state_t::ILLEGAL_DATA_VALUE }, // RDY_TO_CALL__ON_READ_KEY_EVENTS
+        {   0, 255, state_t::RDY_TO_CALL__ON_READ_WRITE_REGISTERS,                          state_t::ILLEGAL_DATA_VALUE }, // RDY_TO_CALL__ON_READ_WRITE_REGISTERS
+        {   0, 255, state_t::RDY_TO_CALL__ON_WRITE_REGISTERS,                               state_t::ILLEGAL_DATA_VALUE }, // RDY_TO_CALL__ON_WRITE_REGISTERS
+        {   1,   0, state_t::ILLEGAL_DATA_VALUE,                                            state_t::ILLEGAL_DATA_VALUE }, // RDY_TO_CALL__ON_READ_LEDS
+        {   1,   0, state_t::ILLEGAL_DATA_VALUE,                                            state_t::ILLEGAL_DATA_VALUE }, // RDY_TO_CALL__ON_WRITE_LEDS_8
+        {   1,   0, state_t::ILLEGAL_DATA_VALUE,                                            state_t::ILLEGAL_DATA_VALUE }, // RDY_TO_CALL__ON_WRITE_LEDS_12
+        {   1,   0, state_t::ILLEGAL_DATA_VALUE,                                            state_t::ILLEGAL_DATA_VALUE }, // RDY_TO_CALL__ON_GET_SW_STATUS
+        {   1,   0, state_t::ILLEGAL_DATA_VALUE,                                            state_t::ILLEGAL_DATA_VALUE }, // RDY_TO_CALL__ON_READ_INPUT_REGISTERS
+        {   1,   0, state_t::ILLEGAL_DATA_VALUE,                                            state_t::ILLEGAL_DATA_VALUE }, // RDY_TO_CALL__ON_DIAGNOSTICS
+        {   1,   0, state_t::ILLEGAL_DATA_VALUE,                                            state_t::ILLEGAL_DATA_VALUE }, // RDY_TO_CALL__ON_WRITE_SINGLE_LED
+        {   1,   0, state_t::ILLEGAL_DATA_VALUE,                                            state_t::ILLEGAL_DATA_VALUE }, // RDY_TO_CALL__ON_READ_HOLDING
+        {   1,   0, state_t::ILLEGAL_DATA_VALUE,                                            state_t::ILLEGAL_DATA_VALUE }, // RDY_TO_CALL__ON_WRITE_HOLDING
+    };
+
+    struct frame_size_t {
+        uint8_t request; ///< Largest request accepted, address and CRC included
+        uint8_t reply;   ///< Largest reply of the function, 0 if up to the application
+    };
+
+    ///< Largest frames of each declared function, from the ranges of their fields
+    inline constexpr frame_size_t frame_sizes[] = {
+        {   8,   6 }, // READ_DISCRETE_INPUTS on_get_sw_status
+        {   8,   8 }, // WRITE_SINGLE_COIL on_write_single_led
+        {   8,   7 }, // READ_COILS on_read_leds
+        {  10,   8 }, // WRITE_MULTIPLE_COILS on_write_leds_8
+        {  11,   8 }, // WRITE_MULTIPLE_COILS on_write_leds_12
+        {   8,  67 }, // READ_INPUT_REGISTERS on_read_input_registers
+        {   8,   8 }, // DIAGNOSTICS on_diagnostics
+        {   8, 161 }, // READ_HOLDING_REGISTERS on_read_holding
+        { 169, 161 }, // READ_WRITE_MULTIPLE_REGISTERS on_read_write_registers
+        { 165,   8 }, // WRITE_MULTIPLE_REGISTERS on_write_registers
+        {   8,   8 }, // WRITE_SINGLE_REGISTER on_write_holding
+        {   6,   0 }, // CUSTOM on_custom
+        {   8,   0 }, // CUSTOM+1 on_wait_for_change
+        {   6,  70 }, // READ_FIFO_QUEUE on_read_key_events
+    };
+
+    ///< Size of the buffer, holding the largest request or reply
+    inline constexpr uint8_t buffer_size = [] {
+        uint8_t size = 0;
+
+        for (const auto &f : frame_sizes) {
+            size = f.request > size ? f.request : size;
+            size = f.reply > size ? f.reply : size;
+        }
+
+        return size;
+    }();
+
+    static_assert(uint8_t(asx::modbus::error_t::illegal_function_code) == uint8_t(state_t::ILLEGAL_FUNCTION));
+    static_assert(uint8_t(asx::modbus::error_t::illegal_data_address) == uint8_t(state_t::ILLEGAL_DATA_ADDRESS));
+    static_assert(uint8_t(asx::modbus::error_t::illegal_data_value) == uint8_t(state_t::ILLEGAL_DATA_VALUE));
+
     class Datagram {
         using error_t = asx::modbus::error_t;
 
         ///< Adjusted buffer to only receive the largest amount of data possible
-        inline static uint8_t buffer[255];
+        inline static uint8_t buffer[buffer_size];
         ///< Number of characters in the buffer
         inline static uint8_t cnt;
         ///< Number of characters to send
         inline static uint8_t frame_size;
-        ///< Error code
-        inline static error_t error;
         ///< State
         inline static state_t state;
-        ///< CRC for the datagram
-        inline static asx::modbus::Crc crc{};
+        ///< CRC for the datagram. Covers the reception, then the reply as it is packed.
+        inline static console::Crc crc{};
+        ///< Address of the device, matched at runtime rather than by the transitions
+        inline static uint8_t address = 37;
+        ///< The frame is a broadcast, which is never replied
+        inline static bool broadcast;
+        ///< The frame did not fit in the buffer. Only set when the parsing is deferred.
+        inline static bool overflow;
+
+        static constexpr uint8_t broadcast_address = 0;
+
+        /** Functions applied when broadcast: the writes */
+        static constexpr bool accepts_broadcast(uint8_t function) noexcept {
+            return function == 5 or function == 6 or function == 15 or function == 16;
+        }
 
         static inline auto ntoh(const uint8_t offset) -> uint16_t {
             return (static_cast<uint16_t>(buffer[offset]) << 8) | static_cast<uint16_t>(buffer[offset + 1]);
@@ -59,7 +365,55 @@ namespace console {
                 static_cast<uint16_t>(buffer[offset+3]);
         }
 
+        /**
+         * Parse the frame stored by process_char in one go, when deferred.
+         * A frame for another node is dropped on its address, before any CRC is computed.
+         * A frame too large for the buffer cannot have its CRC checked, and counts as a bad CRC.
+         */
+        static void parse() noexcept {
+            if ( cnt == 0 or (state = match_address(buffer[0])) == state_t::IGNORE ) {
+                state = state_t::IGNORE;
+                return;
+            }
+
+            crc.update(std::string_view{(const char *)buffer, cnt});
+
+            // Once in error, the rest of the frame is not looked at
+            for (uint8_t i = 1; i < cnt and state >= state_t::DEVICE_ADDRESS; ++i) {
+                state = step(state, buffer[i]);
+            }
+        }
+
+        /** @return The state once the address is received */
+        static inline state_t match_address(const uint8_t c) noexcept {
+            broadcast = c == broadcast_address;
+            return (c == address or broadcast) ? state_t::DEVICE_37 : state_t::IGNORE;
+        }
+
+        /** @return The state once the byte is received, past the address */
+        static inline state_t step(const state_t from, const uint8_t c) noexcept {
+            // One lookup per byte, the alternatives are only visited if the byte is rejected
+            auto next = from;
+
+            do {
+                const auto &t = transitions[uint8_t(next) - uint8_t(state_t::DEVICE_37)];
+
+                if ( c >= t.min and c <= t.max ) {
+                    return t.next;
+                }
+
+                next = t.other;
+            } while ( next >= state_t::DEVICE_37 );
+
+            return next;
+        }
+
     public:
+        /** @return The reply fits the buffer, for the handlers to check their largest reply at compile time */
+        static constexpr bool fits(uint16_t size) noexcept {
+            return size <= buffer_size;
+        }
+
         // Status of the datagram
         enum class status_t : uint8_t {
             GOOD_FRAME = 0,
@@ -67,118 +421,236 @@ namespace console {
             BAD_CRC = 2
         };
 
+        /** Frames are parsed at T3.5 rather than as the characters come (see CONSOLE_DEFERRED_PARSING) */
+        static constexpr bool deferred = CONSOLE_DEFERRED_PARSING;
+
         static void reset() noexcept {
             cnt=0;
             crc.reset();
-            error = error_t::ok;
             state = state_t::DEVICE_ADDRESS;
+            overflow = false;
+        }
+
+        /** Called once per frame, which is accounted for */
+        static void set_address(uint8_t value) noexcept {
+            address = value;
+        }
+
+        static uint8_t get_address() noexcept {
+            return address;
+        }
+
+        /** @return The frame being handled was broadcast, and will not be replied */
+        static bool is_broadcast() noexcept {
+            return broadcast;
         }
 
         static status_t get_status() noexcept {
+            using namespace console;
+
+            if constexpr ( deferred ) {
+                parse();
+            }
+
+            diagnostics::increment(diagnostics::frames);
+
             if (state == state_t::IGNORE) {
+                diagnostics::increment(diagnostics::frames_not_for_me);
                 return status_t::NOT_FOR_ME;
             }
 
-            return crc.check() ? status_t::GOOD_FRAME : status_t::BAD_CRC;
+            if ( overflow or not crc.check() ) {
+                diagnostics::increment(diagnostics::frames_bad_crc);
+                return status_t::BAD_CRC;
+            }
+
+            return status_t::GOOD_FRAME;
         }
 
         static void process_char(const uint8_t c) noexcept {
+            // Only store, the frame is parsed once complete
+            if constexpr ( deferred ) {
+                if ( cnt == sizeof(buffer) ) {
+                    overflow = true;
+                } else {
+                    buffer[cnt++] = c;
+                }
+
+                return;
+            }
+
             if (state == state_t::IGNORE) {
                 return;
             }
 
             crc(c);
 
-            if (state != state_t::ERROR) {
-                // Store the frame
-                buffer[cnt++] = c; // Store the data
+            // Once in error, only the CRC matters
+            if (state < state_t::DEVICE_ADDRESS) {
+                return;
             }
 
-            switch(state) {
-            case state_t::ERROR:
-                break;
-            case state_t::DEVICE_ADDRESS:
-                if ( c == 37 ) {
-                    state = state_t::DEVICE_37;
-                } else {
-                    error = error_t::ignore_frame;
-                    state = state_t::IGNORE;
-                }
-                break;
-            case state_t::DEVICE_37:
-                if ( c == 101 ) {
-                    state = state_t::DEVICE_37_CUSTOM;
-                } else {
-                    error = error_t::illegal_function_code;
-                    state = state_t::ERROR;
-                }
-                break;
-            case state_t::DEVICE_37_CUSTOM:
-                if ( cnt == 4 ) {
-                    state = state_t::DEVICE_37_CUSTOM__ON_CUSTOM__CRC;
-                }
-                break;
-            case state_t::DEVICE_37_CUSTOM__ON_CUSTOM__CRC:
-                if ( cnt == 6 ) {
-                    state = state_t::RDY_TO_CALL__ON_CUSTOM;
-                }
-                break;
-            case state_t::RDY_TO_CALL__ON_CUSTOM:
-            default:
-                error = error_t::illegal_data_value;
-                state = state_t::ERROR;
-                break;
+            // Store the data
+            if ( cnt == sizeof(buffer) ) {
+                state = state_t::ILLEGAL_DATA_VALUE;
+                return;
             }
+
+            buffer[cnt++] = c;
+
+            // The address is matched at runtime, the transitions take over from the function code
+            if ( state == state_t::DEVICE_ADDRESS ) {
+                state = match_address(c);
+                return;
+            }
+
+            state = step(state, c);
+        }
+
+        /** Append a byte to the reply, keeping the CRC up to date */
+        static inline void put(const uint8_t c) noexcept {
+            crc(c);
+            buffer[cnt++] = c;
         }
 
         static void reply_error( error_t err ) noexcept {
-            buffer[1] |= 0x80;
-            buffer[2] = (uint8_t)err;
-            cnt = 3;
+            // The function code is marked, so the CRC starts over
+            crc.reset();
+            cnt = 0;
+
+            // No reply at all. The application may answer later on its own.
+            if ( err == error_t::ignore_frame ) {
+                return;
+            }
+
+
+            put(buffer[0]);
+            put(buffer[1] | 0x80);
+            put((uint8_t)err);
+        }
+
+        /** Append bytes to the reply, as they are */
+        static void pack(const uint8_t *data, uint8_t size) noexcept {
+            while ( size-- ) {
+                put(*data++);
+            }
         }
 
         template<typename T>
         static void pack(const T& value) noexcept {
             if constexpr ( sizeof(T) == 1 ) {
-                buffer[cnt++] = value;
+                put(value);
             } else if constexpr ( sizeof(T) == 2 ) {
-                buffer[cnt++] = value >> 8;
-                buffer[cnt++] = value & 0xff;
+                put(value >> 8);
+                put(value & 0xff);
             } else if constexpr ( sizeof(T) == 4 ) {
-                buffer[cnt++] = value >> 24;
-                buffer[cnt++] = value >> 16 & 0xff;
-                buffer[cnt++] = value >> 8 & 0xff;
-                buffer[cnt++] = value & 0xff;
+                put(value >> 24);
+                put(value >> 16 & 0xff);
+                put(value >> 8 & 0xff);
+                put(value & 0xff);
             }
         }
 
-        static inline void set_size(uint8_t size) {
-            cnt = size;
+        /** Reply with a ready-made frame, CRC included. It is sent as is. */
+        template<uint8_t SIZE>
+        static void reply_with(const uint8_t (&frame)[SIZE]) noexcept {
+            static_assert(fits(SIZE), "The reply does not fit the buffer");
+
+            memcpy(buffer, frame, SIZE);
+            frame_size = SIZE;
+            cnt = 2; // Unchanged from the reply point of view
+        }
+
+        /** Resize the reply. The CRC covers the bytes kept from the request. */
+        static inline void set_size(uint8_t size) noexcept {
+            if ( size < cnt ) {
+                crc.reset();
+                cnt = 0;
+            }
+
+            while ( cnt < size ) {
+                crc(buffer[cnt++]);
+            }
         }
 
         /** Called when a T3.5 has been detected, in a good sequence */
         static void ready_reply() noexcept {
             frame_size = cnt; // Store the frame size
+
+            // The reply CRC starts over the address and function code
+            crc.reset();
+            crc(buffer[0]);
+            crc(buffer[1]);
             cnt = 2; // Points to the function code
-            
+
+            // A broadcast only applies the writes
+            if ( broadcast and not accepts_broadcast(buffer[1]) ) {
+                cnt = 0;
+                return;
+            }
 
             switch(state) {
             case state_t::IGNORE:
                 break;
-            case state_t::DEVICE_ADDRESS:
-            case state_t::DEVICE_37:
-            case state_t::DEVICE_37_CUSTOM:
-            case state_t::DEVICE_37_CUSTOM__ON_CUSTOM__CRC:
-                error = error_t::illegal_data_value;
-            case state_t::ERROR:
-                buffer[1] |= 0x80; // Mark the error
-                buffer[2] = (uint8_t)error; // Add the error code
-                cnt = 3;
+            case state_t::ILLEGAL_FUNCTION:
+            case state_t::ILLEGAL_DATA_ADDRESS:
+            case state_t::ILLEGAL_DATA_VALUE:
+                reply_error(error_t(state));
                 break;
             case state_t::RDY_TO_CALL__ON_CUSTOM:
                 on_custom(ntoh(2));
                 break;
+            case state_t::RDY_TO_CALL__ON_WAIT_FOR_CHANGE:
+                on_wait_for_change(ntoh(2), buffer[4], buffer[5]);
+                break;
+            case state_t::RDY_TO_CALL__ON_READ_WRITE_REGISTERS:
+                // The payload runs to the CRC
+                if ( frame_size < 13 ) {
+                    reply_error(error_t::illegal_data_value);
+                } else {
+                    on_read_write_registers(ntoh(2), ntoh(4), ntoh(6), ntoh(8), buffer[10], &buffer[11], frame_size - 13);
+                }
+                break;
+            case state_t::RDY_TO_CALL__ON_WRITE_REGISTERS:
+                if ( frame_size < 9 ) {
+                    reply_error(error_t::illegal_data_value);
+                } else {
+                    on_write_registers(ntoh(2), ntoh(4), buffer[6], &buffer[7], frame_size - 9);
+                }
+                break;
+            case state_t::RDY_TO_CALL__ON_READ_KEY_EVENTS:
+                on_read_key_events(ntoh(2));
+                break;
+            case state_t::RDY_TO_CALL__ON_READ_LEDS:
+                on_read_leds(buffer[3], buffer[5]);
+                break;
+            case state_t::RDY_TO_CALL__ON_WRITE_LEDS_8:
+                on_write_leds_8(buffer[3], buffer[5], buffer[6], buffer[7]);
+                break;
+            case state_t::RDY_TO_CALL__ON_WRITE_LEDS_12:
+                on_write_leds_12(buffer[3], buffer[5], buffer[6], ntoh(7));
+                break;
+            case state_t::RDY_TO_CALL__ON_GET_SW_STATUS:
+                on_get_sw_status(buffer[3], buffer[5]);
+                break;
+            case state_t::RDY_TO_CALL__ON_READ_INPUT_REGISTERS:
+                on_read_input_registers(ntoh(2), ntoh(4));
+                break;
+            case state_t::RDY_TO_CALL__ON_DIAGNOSTICS:
+                on_diagnostics(ntoh(2), ntoh(4));
+                break;
+            case state_t::RDY_TO_CALL__ON_WRITE_SINGLE_LED:
+                on_write_single_led(buffer[3], ntoh(4));
+                break;
+            case state_t::RDY_TO_CALL__ON_READ_HOLDING:
+                on_read_holding(ntoh(2), ntoh(4));
+                break;
+            case state_t::RDY_TO_CALL__ON_WRITE_HOLDING:
+                on_write_holding(ntoh(2), ntoh(4));
+                break;
             default:
+                // The frame ended early
+                reply_error(error_t::illegal_data_value);
                 break;
             }
 
@@ -186,13 +658,21 @@ namespace console {
             if ( cnt == 2 ) {
                 // Framesize includes the previous CRC which still holds valid
                 cnt = frame_size;
-            } else {
-                // Add the CRC
-                crc.reset();
-                auto _crc = crc.update(std::string_view{(char *)buffer, cnt});
+            } else if ( cnt != 0 ) {
+                // The CRC is up to date, append it
+                auto _crc = crc.get();
                 buffer[cnt++] = _crc & 0xff;
                 buffer[cnt++] = _crc >> 8;
             }
+
+            if ( broadcast ) {
+                cnt = 0;
+            }
+
+            // The deferred replies are not accounted for
+            if ( cnt != 0 and (buffer[1] & 0x80) ) {
+                console::diagnostics::increment(console::diagnostics::exceptions);
+            }
         }
 
         static std::string_view get_buffer() noexcept {
@@ -200,4 +680,4 @@ namespace console {
             return std::string_view{(char *)buffer, cnt};
         }
     }; // struct Processor
-} // namespace modbus
\ No newline at end of file
+} // namespace modbus
@@ -0,0 +1,45 @@
+/**
+ * Simulation of the EEPROM of the ATtiny3224
+ * A write takes the time of a page erase and write. Writing again before it is over would block
+ *  the firmware on the target, and ends the simulation.
+ */
+#include <array>
+#include <cstdint>
+
+#include <alert.h>
+#include <avr/eeprom.h>
+
+#include "sim.hpp"
+
+namespace {
+   constexpr uintptr_t size = 256;
+   constexpr auto write_time = sim::ns(std::chrono::milliseconds{4});
+
+   sim::time_t busy_until = 0;
+
+   auto cells = [] {
+      std::array<uint8_t, size> erased;
+      erased.fill(0xff);
+      return erased;
+   }();
+}
+
+uint8_t eeprom_read_byte(const uint8_t *address) {
+   alert_and_stop_if(uintptr_t(address) >= size);
+   return cells[uintptr_t(address)];
+}
+
+bool eeprom_is_ready() {
+   return sim::now() >= busy_until;
+}
+
+void eeprom_update_byte(uint8_t *address, uint8_t value) {
+   alert_and_stop_if(uintptr_t(address) >= size);
+   alert_and_stop_if(not eeprom_is_ready());
+
+   if ( cells[uintptr_t(address)] != value ) {
+      cells[uintptr_t(address)] = value;
+      busy_until = sim::now() + write_time;
+      sim::trace("eeprom: %u = %u", unsigned(uintptr_t(address)), value);
+   }
+}
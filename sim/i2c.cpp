@@ -0,0 +1,410 @@
+/**
+ * Simulation of the I2C master and of the PCA9555 expanders on the bus
+ * Each transfer occupies the bus for the time its bits take at the configured frequency.
+ * The completion callback is called at the end of the transfer, like the master ISR would.
+ * Each transfer takes effect at its own end, and is followed by the stop.
+ * The bus occupancy is accounted apart for the writes and the reads.
+ * The /INT output of an expander is asserted while an input differs from the value last read
+ *  from its port. The outputs of both expanders are wired together to MUX_INT_PIN.
+ * With --i2c-faults, faults are injected at random, each hitting the next transfer: a NACK, an
+ *  expander browning out (it does not answer for a few ms, then powers on unconfigured) or a
+ *  slave holding SDA low until the master clears the bus (see src/i2c_bus.hpp). An expander hit
+ *  is recovered once its inputs are read again with its configuration restored, which must
+ *  happen within a bound.
+ *  The key, switch and LED checks are excused meanwhile, and until the inputs settle again.
+ * With --dead-expander, an expander never answers, so the console must come up without it and
+ *  report the I2C fault. The checks of its keys, switches and LEDs are excused for the whole run.
+ */
+#include <cstdio>
+#include <random>
+
+#include <alert.h>
+#include <asx/i2c_master.hpp>
+#include <asx/ioport.hpp>
+#include <conf_board.h>
+
+#include "i2c_bus.hpp"
+#include "sim.hpp"
+
+namespace {
+   /// PCA9555 register map
+   enum : uint8_t { input = 0, output = 2, polarity = 4, config = 6 };
+
+   struct Expander {
+      uint8_t reg[8];
+      uint8_t pins[2];     ///< Level driven externally on each port
+      uint8_t captured[2]; ///< Input port value as last read, reference for /INT
+      bool off;            ///< Browned out, does not answer
+      bool dead;           ///< Never answers, nor drives /INT
+      sim::time_t down_since; ///< Hit by a fault not recovered yet, 0 if none
+      uint8_t expected[4]; ///< Polarity and configuration registers when hit, to be restored
+
+      void power_on() {
+         for (uint8_t port = 0; port < 2; ++port) {
+            reg[output + port] = 0xff;
+            reg[polarity + port] = 0;
+            reg[config + port] = 0xff;
+            captured[port] = input_port(port);
+         }
+      }
+
+      /// Pins configured as outputs read back the output register
+      uint8_t input_port(uint8_t port) const {
+         auto dir = reg[config + port];
+         auto level = (pins[port] & dir) | (reg[output + port] & ~dir);
+         return level ^ reg[polarity + port];
+      }
+
+      /// /INT is only asserted by the pins configured as inputs
+      bool interrupting() const {
+         for (uint8_t port = 0; port < 2; ++port) {
+            if ( (input_port(port) ^ captured[port]) & reg[config + port] ) {
+               return true;
+            }
+         }
+
+         return false;
+      }
+
+      /// Registers work in pairs, the address toggles within the pair
+      static uint8_t next(uint8_t r) {
+         return r ^ 1;
+      }
+   };
+
+   constexpr uint8_t base_address = 0x20;
+   constexpr uint8_t nb_expanders = 2;
+
+   Expander expanders[nb_expanders];
+
+   /// Faults, armed at random and hitting the next transfer
+   enum class fault_t : uint8_t { none, nack, brownout, stuck, count };
+
+   constexpr auto first_fault = sim::ns(std::chrono::milliseconds{100});
+   constexpr auto brownout_min = sim::ns(std::chrono::milliseconds{1});
+   constexpr auto brownout_max = sim::ns(std::chrono::milliseconds{5});
+   constexpr auto recovery_bound = sim::ns(std::chrono::milliseconds{50}); ///< From the hit to the inputs read again
+   constexpr auto settle_time = sim::ns(std::chrono::milliseconds{20});    ///< For the inputs to be sampled again
+
+   std::mt19937 rng;
+   fault_t armed = fault_t::none;
+   uint8_t armed_chip = 0;
+   bool stuck = false;      ///< SDA held low, until the master clears the bus
+   sim::time_t last_fault = 0;
+   sim::time_t last_recovered = 0;
+   uint64_t nb_faults[size_t(fault_t::count)];
+   uint64_t nb_recovered = 0;
+   uint64_t nb_bus_clears = 0;
+   sim::time_t max_recovery = 0;
+
+   uint32_t frequency = 0;
+   bool busy = false;
+   sim::time_t busy_writing = 0;
+   sim::time_t busy_reading = 0;
+   uint64_t nb_writes = 0;
+   uint64_t nb_reads = 0;
+
+   sim::Probe probe_callback{"i2c completion", &sim::options.max_i2c_ns};
+
+   /// The open drain /INT outputs pull the line low together
+   void update_int() {
+      bool asserted = false;
+
+      for (auto &expander : expanders) {
+         asserted = asserted or (not expander.dead and expander.interrupting());
+      }
+
+      sim::ioport::drive(MUX_INT_PIN, not asserted);
+   }
+
+   Expander *find(uint8_t chip) {
+      if ( chip < base_address or chip >= base_address + nb_expanders ) {
+         return nullptr;
+      }
+
+      return &expanders[chip - base_address];
+   }
+
+   void hit(Expander &expander) {
+      if ( expander.down_since == 0 and not expander.dead ) {
+         expander.down_since = sim::now();
+
+         for (uint8_t i = 0; i < 4; ++i) {
+            expander.expected[i] = expander.reg[polarity + i];
+         }
+      }
+   }
+
+   /// @brief An armed fault hits the transfer to a chip
+   void strike(uint8_t chip) {
+      auto kind = armed;
+      auto expander = find(chip);
+
+      armed = fault_t::none;
+      last_fault = sim::now();
+      ++nb_faults[size_t(kind)];
+      sim::trace("i2c: %s fault on chip %02x", kind == fault_t::nack ? "nack" : kind == fault_t::brownout ? "brownout" : "stuck", chip);
+
+      if ( kind == fault_t::stuck ) {
+         stuck = true;
+
+         for (auto &e : expanders) {
+            hit(e);
+         }
+      } else if ( expander ) {
+         hit(*expander);
+      }
+
+      if ( kind == fault_t::brownout and expander and not expander->dead ) {
+         expander->off = true;
+
+         sim::after(brownout_min + rng() % (brownout_max - brownout_min), [expander] {
+            expander->off = false;
+            expander->power_on();
+            update_int();
+            sim::panel::on_outputs();
+         });
+      }
+   }
+
+   /// @return The expander answering a transfer, nullptr if none does
+   Expander *reach(uint8_t chip) {
+      if ( armed != fault_t::none and (armed == fault_t::stuck or chip == armed_chip) ) {
+         strike(chip);
+         return nullptr;
+      }
+
+      auto expander = find(chip);
+
+      return stuck or expander == nullptr or expander->off or expander->dead ? nullptr : expander;
+   }
+
+   /// @brief The inputs of an expander are read, with its configuration restored after a fault
+   void check_recovered(Expander &expander) {
+      for (uint8_t i = 0; i < 4; ++i) {
+         if ( expander.reg[polarity + i] != expander.expected[i] ) {
+            return;
+         }
+      }
+
+      auto duration = sim::now() - expander.down_since;
+
+      if ( duration > recovery_bound ) {
+         sim::fail("i2c: expander %u recovered after %.1fms", unsigned(&expander - expanders), duration / 1e6);
+      }
+
+      max_recovery = std::max(max_recovery, duration);
+      ++nb_recovered;
+      sim::panel::excuse(expander.down_since, sim::now() + settle_time);
+      expander.down_since = 0;
+      last_recovered = sim::now();
+   }
+
+   /// @brief Occupy the bus for a number of bits, then complete
+   void transfer(unsigned bits, sim::time_t &busy_total, std::function<void()> complete) {
+      alert_and_stop_if(frequency == 0);
+      alert_and_stop_if(busy);
+
+      auto duration = sim::time_t{bits} * 1000000000ULL / frequency;
+
+      busy = true;
+      busy_total += duration;
+
+      sim::after(duration, [complete = std::move(complete)] {
+         busy = false;
+         complete();
+      });
+   }
+
+   void call(asx::i2c::callback_t cb, status_code_t status) {
+      sim::Probe::Measure measure{probe_callback};
+      cb(status);
+   }
+
+   // Bits of each part of a transfer: start, address, command, data bytes, and for a read the
+   //  restart and address. The stop is counted apart.
+   unsigned write_bits(uint8_t size) {
+      return 1 + 9 + 9 + 9U * size;
+   }
+
+   unsigned read_bits(uint8_t size) {
+      return 1 + 9 + 9 + 1 + 9 + 9U * size;
+   }
+
+   /// @return false if no expander answers
+   bool apply_write(uint8_t chip, uint8_t reg, const uint8_t *data, uint8_t size) {
+      auto expander = reach(chip);
+
+      if ( expander == nullptr ) {
+         return false;
+      }
+
+      for (uint8_t i = 0; i < size; ++i) {
+         expander->reg[reg] = data[i];
+         reg = Expander::next(reg);
+      }
+
+      update_int();
+      sim::panel::on_outputs();
+
+      return true;
+   }
+
+   /// @return false if no expander answers
+   bool apply_read(uint8_t chip, uint8_t reg, uint8_t *data, uint8_t size) {
+      auto expander = reach(chip);
+
+      if ( expander == nullptr ) {
+         return false;
+      }
+
+      if ( expander->down_since and reg < output ) {
+         check_recovered(*expander);
+      }
+
+      for (uint8_t i = 0; i < size; ++i) {
+         if ( reg < output ) {
+            data[i] = expander->captured[reg] = expander->input_port(reg);
+         } else {
+            data[i] = expander->reg[reg];
+         }
+         reg = Expander::next(reg);
+      }
+
+      update_int();
+
+      return true;
+   }
+}
+
+namespace asx {
+   namespace i2c {
+      void Master::init(uint32_t freq) {
+         frequency = freq;
+
+         for (auto &expander : expanders) {
+            expander.power_on();
+            expander.dead = &expander - expanders == sim::options.dead_expander;
+         }
+      }
+
+      void Master::write(uint8_t chip, uint8_t reg, const uint8_t *data, uint8_t size, callback_t cb) {
+         uint8_t copy[16];
+
+         alert_and_stop_if(size > sizeof(copy));
+
+         for (uint8_t i = 0; i < size; ++i) {
+            copy[i] = data[i];
+         }
+
+         ++nb_writes;
+
+         transfer(write_bits(size) + 1, busy_writing, [=] {
+            call(cb, apply_write(chip, reg, copy, size) ? STATUS_OK : ERR_IO_ERROR);
+         });
+      }
+
+      void Master::read(uint8_t chip, uint8_t reg, uint8_t *data, uint8_t size, callback_t cb) {
+         ++nb_reads;
+
+         transfer(read_bits(size) + 1, busy_reading, [=] {
+            call(cb, apply_read(chip, reg, data, size) ? STATUS_OK : ERR_IO_ERROR);
+         });
+      }
+   }
+}
+
+namespace console {
+   namespace i2c_bus {
+      /// The clocks let go of the slave holding SDA, the master is reset without touching the expanders
+      void clear(uint32_t freq) {
+         alert_and_stop_if(busy);
+
+         if ( stuck ) {
+            sim::trace("i2c: bus cleared");
+         }
+
+         stuck = false;
+         frequency = freq;
+         ++nb_bus_clears;
+      }
+   }
+}
+
+namespace sim {
+   namespace i2c {
+      namespace {
+         /// @brief Arm a fault for the next transfer, unless the last one is still being recovered
+         void inject() {
+            std::exponential_distribution<double> interval{options.i2c_faults};
+
+            if ( armed == fault_t::none and not disturbed() ) {
+               armed = fault_t(1 + rng() % (size_t(fault_t::count) - 1));
+               armed_chip = base_address + rng() % nb_expanders;
+            }
+
+            after(time_t(interval(rng) * 1e9), inject);
+         }
+      }
+
+      void start() {
+         rng.seed(options.seed * 104729);
+
+         if ( options.dead_expander >= nb_expanders ) {
+            fail("i2c: no expander %d, there are %u", options.dead_expander, nb_expanders);
+         } else if ( options.dead_expander >= 0 ) {
+            panel::excuse(0, options.duration);
+         }
+
+         if ( options.i2c_faults > 0 ) {
+            after(first_fault, inject);
+         }
+      }
+
+      bool disturbed(time_t since) {
+         bool down = stuck;
+
+         for (auto &expander : expanders) {
+            down = down or expander.down_since != 0 or expander.dead;
+         }
+
+         return down or (last_fault and last_fault >= since) or (last_recovered and now() < last_recovered + settle_time);
+      }
+
+      void set_pins(uint8_t chip, uint8_t port, uint8_t value) {
+         expanders[chip].pins[port] = value;
+         update_int();
+      }
+
+      uint8_t get_outputs(uint8_t chip, uint8_t port) {
+         auto &expander = expanders[chip];
+         return expander.reg[output + port] & ~expander.reg[config + port];
+      }
+
+      void report() {
+         printf("I2C bus @%ukHz:\n", frequency / 1000);
+         printf("  writes %llu, reads %llu\n", (unsigned long long)nb_writes, (unsigned long long)nb_reads);
+         auto percent = [](sim::time_t busy) { return now() ? 100.0 * busy / now() : 0.0; };
+
+         printf("  bus occupancy %.2f%% (writes %.2f%%, reads %.2f%%)\n",
+            percent(busy_writing + busy_reading), percent(busy_writing), percent(busy_reading));
+
+         if ( options.i2c_faults > 0 ) {
+            printf("  faults: nack %llu, brownout %llu, stuck SDA %llu, recovered %llu, max recovery %.1fms, bus clears %llu\n",
+               (unsigned long long)nb_faults[size_t(fault_t::nack)], (unsigned long long)nb_faults[size_t(fault_t::brownout)],
+               (unsigned long long)nb_faults[size_t(fault_t::stuck)], (unsigned long long)nb_recovered,
+               max_recovery / 1e6, (unsigned long long)nb_bus_clears);
+         }
+
+         if ( options.dead_expander >= 0 ) {
+            printf("  expander %d dead, bus clears %llu\n", options.dead_expander, (unsigned long long)nb_bus_clears);
+         }
+
+         for (auto &expander : expanders) {
+            if ( expander.down_since and expander.down_since + recovery_bound < now() ) {
+               fail("i2c: expander %u not recovered since %.3fs", unsigned(&expander - expanders), expander.down_since / 1e9);
+            }
+         }
+      }
+   }
+}
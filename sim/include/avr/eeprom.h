@@ -0,0 +1,15 @@
+#pragma once
+/**
+ * Simulation stand-in for the avr-libc EEPROM access
+ * The EEPROM starts erased at each run. A write keeps it busy for a while, and the firmware must
+ *  wait for it to be ready rather than have the write wait.
+ */
+#include <cstdint>
+
+uint8_t eeprom_read_byte(const uint8_t *address);
+
+/// @return The previous write is over
+bool eeprom_is_ready();
+
+/// @brief Write a byte, only if it differs
+void eeprom_update_byte(uint8_t *address, uint8_t value);
@@ -0,0 +1,1078 @@
+/**
+ * Simulation of the Modbus master (the machine controller)
+ * At power-up, the status is read until the console reports it is ready. Its boot to ready time
+ *  must be consistent with the time of the reply.
+ * The custom poll frame is sent every 20ms. With --long-poll, the wait for change frame is sent
+ *  instead, again as soon as it is answered. Every few cycles, another request follows the poll
+ *  reply: reading the LEDs back, writing them as coils, reading the key register, sounding the
+ *  buzzer, draining the key events, beeping and writing the LEDs then reading the state back in
+ *  a single transaction, blinking or dimming an LED, uploading a tune, reading out of range or
+ *  talking to another node of the bus, reading or clearing the diagnostics counters,
+ *  broadcasting the LEDs or a slave address which the console must not take, moving the console
+ *  to another address or changing the line rate. A rate change is committed at the new rate, or
+ *  once in a while left to revert while the master keeps quiet.
+ * The buzzer plays the uploaded tune every other time.
+ * The counters must agree with the frames sent and replied. A broadcast must not be replied.
+ * A write refused for one of its registers must leave all of them as they were.
+ * All replies are checked against the panel model. The key events must follow each other
+ *  without a gap, alternating presses and releases. The gestures in between must be timed from
+ *  the press they follow: a long press, its repeats, and a double press right after the press.
+ * The traffic follows a profile (--profile): the full mix above by default, the production mix
+ *  of the controller (polls, coils, buzzer and frames for other nodes), or the same mix sent
+ *  back to back to saturate the line.
+ * A reply must start after a silence of T3.5 from the request, and run without a gap over T1.5.
+ * With --handler-latency-us, a broadcast or a frame for another node is followed at T3.5, while
+ *  the console has yet to handle it.
+ * The inputs and LEDs are not checked while an I2C fault disturbs the expanders. The I2C errors
+ *  counted by the console must then add up over the expanders, and be none without faults.
+ * The round-trip times are kept for a histogram and their percentiles. With --json, the results
+ *  are also saved for the builds to be compared.
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <conf_mux.h>
+
+#include "sim.hpp"
+
+namespace sim {
+   namespace master {
+      namespace {
+         constexpr uint8_t addresses[] = {37, 38}; ///< The console moves between them
+         constexpr uint8_t broadcast_address = 0;
+         constexpr uint8_t address_register = 75;
+         constexpr uint8_t buzzer_register = 10;
+         constexpr uint8_t leds_register = 11;       ///< After the buzzer, followed by the 2 write counters,
+                                                     ///<  the key, switches, status and sequence
+         constexpr uint8_t effect_register = 18;     ///< Of the first LED
+         constexpr uint8_t brightness_register = 30; ///< Of the first LED
+         constexpr uint8_t tune_register = 42;       ///< The tempo, then the notes
+         uint8_t device = addresses[0];
+         constexpr uint8_t other_device = 12;
+         constexpr auto response_timeout = ns(std::chrono::milliseconds{5});
+         constexpr uint8_t wait_timeout = 10; ///< Long poll timeout, in 10ms
+         constexpr auto leds_every = 25;    ///< Polls between 2 LED changes
+
+         enum class request_t : uint8_t {
+            custom,
+            wait,
+            ready,
+            read_coils,
+            write_coils,
+            read_key,
+            buzzer,
+            key_events,
+            read_write,
+            effect,
+            dim,
+            tune,
+            diagnostics,
+            broadcast,
+            readdress,
+            baud,
+            bad_address,
+            other_node,
+            count
+         };
+
+         const char *const names[] = {
+            "custom", "wait change", "ready", "read coils", "write coils", "read key", "buzzer", "key events", "read write", "effect", "dim", "tune", "diagnostics", "broadcast", "readdress", "baud", "bad address", "other node"
+         };
+
+         struct Profile {
+            const char *name;
+            time_t poll_period;   ///< 0 to poll again as soon as the previous exchange is over
+            uint8_t extra_every;  ///< Polls between 2 extra requests
+            std::vector<request_t> extras; ///< Extra requests in turn. If empty, all of them with
+                                           ///<  the key events every other time.
+         };
+
+         const std::vector<request_t> production_mix = {
+            request_t::read_coils, request_t::write_coils, request_t::buzzer, request_t::other_node
+         };
+
+         const Profile profiles[] = {
+            {"full", ns(std::chrono::milliseconds{20}), 5, {}},
+            {"production", ns(std::chrono::milliseconds{20}), 2, production_mix},
+            {"saturate", 0, 2, production_mix},
+         };
+
+         const Profile *profile = &profiles[0];
+
+         /// The next poll follows the previous exchange, rather than a period
+         bool chained() {
+            return options.long_poll or profile->poll_period == 0;
+         }
+
+         struct Stats {
+            uint64_t sent;
+            uint64_t replies;
+            uint64_t exceptions;
+            uint64_t timeouts;
+            uint64_t bad_crc;
+            time_t rtt_min;
+            time_t rtt_max;
+            time_t rtt_total;
+         } stats[size_t(request_t::count)];
+
+         // Round-trip times of all the replies, and their histogram doubling from a base
+         constexpr auto rtt_base = ns(std::chrono::microseconds{250});
+         constexpr uint8_t rtt_bins = 8;
+         std::vector<time_t> rtts;
+         uint64_t rtt_histogram[rtt_bins];
+
+         // Line timing of the replies
+         time_t last_received;          ///< End of the last character of the reply
+         uint64_t nb_early_replies = 0; ///< Started less than T3.5 after the request
+         uint64_t nb_gapped_replies = 0; ///< With a silence over T1.5 between 2 characters
+
+         std::mt19937 rng;
+
+         // Request in progress
+         request_t pending;
+         uint8_t request[32];
+         uint8_t reply[256];
+         uint8_t reply_size;
+         time_t sent_at;
+         uint32_t generation = 0; ///< Invalidates stale timeouts
+
+         uint32_t cycle = 0;
+
+         /// @return Silence of a number of half characters at the current rate of the master,
+         ///  fixed above 19200 baud where the character is shorter
+         time_t silence(unsigned halves, time_t fixed) {
+            auto t = rs485::master_char_time() * halves / 2;
+            return t < fixed ? fixed : t;
+         }
+
+         time_t t1_5() {
+            return silence(3, ns(std::chrono::microseconds{750}));
+         }
+
+         time_t t3_5() {
+            return silence(7, ns(std::chrono::microseconds{1750}));
+         }
+
+         /// @return The stats of all the requests added up
+         Stats get_totals() {
+            Stats totals{};
+
+            for (auto &s : stats) {
+               totals.sent += s.sent;
+               totals.replies += s.replies;
+               totals.exceptions += s.exceptions;
+               totals.timeouts += s.timeouts;
+               totals.bad_crc += s.bad_crc;
+            }
+
+            return totals;
+         }
+
+         double percent(uint64_t count, uint64_t total) {
+            return total ? 100.0 * count / total : 0.0;
+         }
+
+         /// @return A round-trip time percentile, in ns
+         time_t percentile(double rank) {
+            if ( rtts.empty() ) {
+               return 0;
+            }
+
+            auto nth = rtts.begin() + size_t(rank * (rtts.size() - 1));
+            std::nth_element(rtts.begin(), nth, rtts.end());
+
+            return *nth;
+         }
+         // Key events
+         uint8_t next_sequence = 0;
+         uint8_t pressed_code = 0; ///< Code of the last press, 0 once released
+         bool events_started = false;
+         uint64_t nb_events = 0;
+         uint64_t nb_presses = 0;
+
+         // Gestures, the codes are 5 bits with the kind above
+         constexpr uint8_t gesture_msk = 0x60;
+         constexpr uint8_t long_press = 0x20;
+         constexpr uint8_t repeat = 0x40;
+         constexpr uint8_t double_press = 0x60;
+         constexpr uint8_t max_code = 16;   ///< Shifted keys and chords included
+         constexpr uint16_t gesture_slack = 5; ///< ms a gesture may be emitted late
+
+         uint16_t pressed_at = 0;           ///< Time stamp of the press, in ms
+         uint16_t gesture_at = 0;           ///< Time stamp of the last long press or repeat, 0 if none
+         uint16_t released_at[max_code + 1];
+         uint64_t nb_long_presses = 0;
+         uint64_t nb_repeats = 0;
+         uint64_t nb_double_presses = 0;
+
+         uint8_t change_sequence = 0; ///< Last change sequence of a wait reply
+
+         // LED effect
+         constexpr uint8_t blink_led = 11;
+         constexpr uint16_t blink_effect = 0x4000 | 10 << 7; ///< 200ms period
+         constexpr auto blink_half_period = ns(std::chrono::milliseconds{100});
+         bool blinking = false;     ///< Acknowledged blinking
+         time_t blink_started;
+         uint64_t blink_toggles;    ///< Toggles seen since blinking
+         bool blink_state;
+         uint64_t nb_blink_toggles = 0;
+
+         // LED dimming
+         constexpr uint8_t dim_led = 10;
+         constexpr uint8_t dim_level = 4;   ///< Out of 15
+         constexpr auto dim_tolerance = 0.03;
+         constexpr auto dim_min_time = ns(std::chrono::milliseconds{100});
+         bool dimmed = false;       ///< Acknowledged dimmed
+         time_t dim_mark;           ///< Last accounting of the expected lit time
+         time_t dim_expected;       ///< Time the LED is lit in the LED word since dimmed
+         time_t dim_lit_start;      ///< Lit time measured by the panel once dimmed
+         time_t dim_started;
+         double dim_duty_min = 1, dim_duty_max = 0;
+
+         // Uploaded tune
+         constexpr uint8_t tune_tempo = 240;
+         constexpr uint8_t tune_size = 3;
+         constexpr auto tune_duration = ns(std::chrono::milliseconds{tune_size * 60000 / tune_tempo});
+         constexpr auto tune_tolerance = 0.01;
+         uint8_t tune_pitches[tune_size];  ///< Pitches sent with the last upload
+         bool tune_uploaded = false;
+         bool tune_playing = false;        ///< Triggered, and not checked yet
+         size_t tune_first;                ///< Rank of the first note of the tune played
+         time_t tune_started;
+         uint64_t nb_tunes_checked = 0;
+
+         // Diagnostics counters, as they should be on the console since cleared
+         bool diag_clear = false;         ///< Clear rather than read the next time
+         uint16_t diag_frames = 0;
+         uint16_t diag_not_for_me = 0;
+         uint16_t diag_exceptions = 0;
+         constexpr uint8_t diag_nb_expanders = 2;
+         constexpr uint8_t diag_expander_errors = 25;  ///< Then the recoveries, a register per expander each
+         constexpr uint8_t diag_expander_recoveries = diag_expander_errors + diag_nb_expanders;
+         constexpr uint8_t diag_count = diag_expander_recoveries + diag_nb_expanders;
+         uint16_t diag_last[diag_count];  ///< Last counters read
+         bool diag_read = false;
+
+         // Line rate
+         constexpr uint8_t baud_register = 76;
+         constexpr uint32_t baud_rates[] = {115200, 230400, 460800, 1000000};
+         constexpr auto baud_switch_delay = ns(std::chrono::milliseconds{5});
+         constexpr auto baud_commit_window = ns(std::chrono::milliseconds{500});
+         uint8_t baud_code = 0;     ///< Committed rate
+         uint8_t baud_next = 0;     ///< Rate requested
+         bool baud_committing = false;
+         time_t quiet_until = 0;    ///< No poll before, while the rate changes
+         uint64_t nb_baud_commits = 0;
+         uint64_t nb_baud_reverts = 0;
+
+         // Boot, the console serves the requests while it reads the inputs for the first time
+         constexpr uint8_t status_register = 16;
+         constexpr uint8_t ready_register = 77;
+         constexpr uint16_t initialising = 0x8;
+         constexpr auto ready_retry = ns(std::chrono::milliseconds{1});
+         time_t ready_at = 0;       ///< Reply showing the console ready
+         uint16_t ready_time = 0;   ///< Time from the start to ready, as the console measured it (us)
+         uint64_t nb_initialising = 0; ///< Replies while initialising
+         constexpr uint16_t i2c_fault = 0x10;
+         uint64_t nb_i2c_faults = 0;   ///< Replies showing an expander out of service
+
+         /// @return The bus is faulty, or an expander dead, so the console may report I2C errors
+         bool faults_expected() {
+            return options.i2c_faults > 0 or options.dead_expander >= 0;
+         }
+
+         /// @brief Check the flags of the status in a reply, once the console is ready
+         void check_flags(const char *name, uint16_t flags) {
+            if ( flags & initialising ) {
+               fail("%s: the console is still initialising", name);
+            }
+
+            if ( flags & i2c_fault ) {
+               ++nb_i2c_faults;
+
+               if ( not faults_expected() ) {
+                  fail("%s: I2C fault without faults on the bus", name);
+               }
+            }
+         }
+
+         bool broadcast_leds = false; ///< The broadcast in progress writes the LEDs, not the address
+
+         uint16_t leds = 0;         ///< LED word sent with the polls
+         uint16_t leds_applied = 0; ///< LED word acknowledged by the console
+         bool leds_valid = false;
+         time_t leds_checked_from = 0; ///< A broadcast followed at once is not handled yet
+
+         /// @brief Account the time the dimmed LED is lit in the LED word, up to a time
+         void account_dim(time_t when) {
+            if ( dimmed and leds_valid and (leds_applied & 1U << dim_led) ) {
+               dim_expected += when - dim_mark;
+            }
+
+            dim_mark = when;
+         }
+
+         /// @brief Check the notes played since the tune was triggered, before it can be stopped or changed
+         void check_tune() {
+            if ( not tune_playing ) {
+               return;
+            }
+
+            size_t played = piezzo::get_note_count() - tune_first;
+            bool complete = now() - tune_started >= tune_duration;
+
+            tune_playing = false;
+            ++nb_tunes_checked;
+
+            if ( played == 0 or played > tune_size or (complete and played != tune_size) ) {
+               fail("tune: %zu note(s) played, expected %u", played, tune_size);
+               return;
+            }
+
+            for (size_t i = 0; i < played; ++i) {
+               double expected = 440 * std::pow(2.0, (tune_pitches[i] - 69) / 12.0);
+               double frequency = piezzo::get_note(tune_first + i);
+
+               if ( std::abs(frequency - expected) > expected * tune_tolerance ) {
+                  fail("tune: note %zu at %.0fHz, expected %.0fHz", i, frequency, expected);
+               }
+            }
+         }
+
+         /// @param when Time the console applied the LED word
+         void apply_leds(time_t when) {
+            account_dim(when);
+            leds_applied = leds;
+            leds_valid = true;
+         }
+
+         void on_silence();
+
+         uint16_t crc16(const uint8_t *data, uint8_t size) {
+            uint16_t crc = 0xffff;
+
+            for (uint8_t i = 0; i < size; ++i) {
+               crc ^= data[i];
+
+               for (uint8_t b = 0; b < 8; ++b) {
+                  crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+               }
+            }
+
+            return crc;
+         }
+
+         void send(request_t type, std::initializer_list<uint8_t> pdu) {
+            uint8_t size = 0;
+
+            for (auto c : pdu) {
+               request[size++] = c;
+            }
+
+            auto crc = crc16(request, size);
+            request[size++] = crc & 0xff;
+            request[size++] = crc >> 8;
+
+            pending = type;
+            reply_size = 0;
+            ++stats[size_t(type)].sent;
+            ++generation;
+            ++diag_frames;
+            diag_not_for_me += type == request_t::other_node;
+
+            rs485::master_send(request, size);
+
+            // The response timeout starts once the request is out
+            auto timeout = response_timeout;
+
+            if ( type == request_t::wait ) {
+               timeout += wait_timeout * ns(std::chrono::milliseconds{10});
+            }
+
+            sent_at = now() + size * rs485::master_char_time();
+
+            // The next frame follows at once, while the handler of the console is late for this one
+            if ( options.handler_latency and (type == request_t::broadcast or type == request_t::other_node) ) {
+               timeout = t3_5();
+            }
+
+            at(sent_at + timeout, [gen = generation] {
+               if ( gen == generation and reply_size == 0 ) {
+                  on_silence();
+               }
+            });
+         }
+
+         /// @brief Read the status up to the ready time
+         void send_ready() {
+            send(request_t::ready, {device, 3, 0, status_register, 0, ready_register - status_register + 1});
+         }
+
+         void send_extra() {
+            // The key events are read every other time, so the queue does not overflow as requests are added
+            auto slot = cycle / profile->extra_every;
+            constexpr auto first = size_t(request_t::read_coils);
+            auto type = slot % 2 ? request_t::key_events : request_t(first + slot / 2 % (size_t(request_t::count) - first));
+
+            if ( not profile->extras.empty() ) {
+               type = profile->extras[slot % profile->extras.size()];
+            }
+
+            switch (type) {
+            case request_t::read_coils:
+               send(type, {device, 1, 0, 0, 0, 12});
+               break;
+            case request_t::write_coils:
+               leds = rng() & 0xfff;
+               send(type, {device, 15, 0, 0, 0, 12, 2, uint8_t(leds & 0xff), uint8_t(leds >> 8)});
+               break;
+            case request_t::read_key:
+               send(type, {device, 4, 0, 0, 0, 1});
+               break;
+            case request_t::buzzer: {
+               check_tune();
+
+               bool play_tune = tune_uploaded and rng() % 2;
+
+               if ( play_tune ) {
+                  tune_playing = true;
+                  tune_first = piezzo::get_note_count();
+                  tune_started = now();
+               }
+
+               send(type, {device, 6, 0, buzzer_register, 0, uint8_t(play_tune ? 4 : 1 + rng() % 3)});
+               break;
+            }
+            case request_t::tune:
+               // Tempo, the notes of 1 beat and the end of the tune
+               check_tune();
+
+               for (auto &pitch : tune_pitches) {
+                  pitch = 48 + rng() % 36;
+               }
+
+               send(type, {device, 16, 0, tune_register, 0, tune_size + 2, 2 * (tune_size + 2), 0, tune_tempo,
+                  tune_pitches[0], 1, tune_pitches[1], 1, tune_pitches[2], 1, 0, 0});
+               break;
+            case request_t::key_events:
+               send(type, {device, 24, 0, 0});
+               break;
+            case request_t::dim:
+               send(type, {device, 6, 0, uint8_t(brightness_register + dim_led), 0, dimmed ? uint8_t(15) : dim_level});
+               break;
+            case request_t::effect: {
+               uint16_t effect = blinking ? 0 : blink_effect;
+               send(type, {device, 6, 0, uint8_t(effect_register + blink_led), uint8_t(effect >> 8), uint8_t(effect & 0xff)});
+               break;
+            }
+            case request_t::read_write:
+               // Beep and write the LEDs, read them back with the registers after them
+               check_tune();
+               leds = rng() & 0xfff;
+               send(type, {device, 23, 0, leds_register, 0, 7, 0, buzzer_register, 0, 2, 4,
+                  0, uint8_t(1 + rng() % 3), uint8_t(leds >> 8), uint8_t(leds & 0xff)});
+               break;
+            case request_t::diagnostics:
+               if ( diag_clear ) {
+                  send(type, {device, 8, 0, 0x0a, 0, 0});
+               } else {
+                  send(type, {device, 4, 0, 1, 0, diag_count - 1}); // All but the active key
+               }
+               break;
+            case request_t::broadcast:
+               broadcast_leds = rng() % 4 != 0;
+
+               if ( broadcast_leds ) {
+                  leds = rng() & 0xfff;
+                  send(type, {broadcast_address, 15, 0, 0, 0, 12, 2, uint8_t(leds & 0xff), uint8_t(leds >> 8)});
+               } else {
+                  send(type, {broadcast_address, 6, 0, address_register, 0, other_device});
+               }
+               break;
+            case request_t::readdress:
+               send(type, {device, 6, 0, address_register, 0, device == addresses[0] ? addresses[1] : addresses[0]});
+               break;
+            case request_t::baud:
+               baud_next = (baud_code + 1) % 4;
+               send(type, {device, 6, 0, baud_register, 0, baud_next});
+               break;
+            case request_t::bad_address:
+               if ( rng() % 2 ) {
+                  // Runs into the read only counters, so the LEDs must not change (checked by the next poll)
+                  uint16_t other = ~leds_applied & 0xfff;
+                  send(type, {device, 16, 0, leds_register, 0, 2, 4, uint8_t(other >> 8), uint8_t(other & 0xff), 0, 0});
+               } else {
+                  send(type, {device, 1, 0, uint8_t(12 + rng() % 200), 0, 1});
+               }
+               break;
+            default:
+               send(request_t::other_node, {other_device, 101, uint8_t(rng()), uint8_t(rng())});
+               break;
+            }
+         }
+
+         void poll() {
+            // The long poll resumes with the end of the rate change
+            if ( now() < quiet_until ) {
+               if ( not chained() ) {
+                  at(now() + profile->poll_period, poll);
+               }
+               return;
+            }
+
+            ++cycle;
+
+            // A long poll, or a back to back poll, is sent again once answered
+            if ( not chained() ) {
+               at(now() + profile->poll_period, poll);
+            }
+
+            if ( leds_valid and not i2c::disturbed() and now() >= leds_checked_from ) {
+               panel::check_leds(leds_applied, (blinking ? 1U << blink_led : 0) | (dimmed ? 1U << dim_led : 0));
+            }
+
+            if ( blinking and bool(panel::get_leds() & 1U << blink_led) != blink_state ) {
+               blink_state = not blink_state;
+               ++blink_toggles;
+            }
+
+            if ( cycle % leds_every == 0 ) {
+               leds = rng() & 0xfff;
+            }
+
+            if ( options.long_poll ) {
+               send(request_t::wait, {device, 102, uint8_t(leds >> 8), uint8_t(leds & 0xff), change_sequence, wait_timeout});
+            } else {
+               send(request_t::custom, {device, 101, uint8_t(leds >> 8), uint8_t(leds & 0xff)});
+            }
+         }
+
+         /// @brief The poll and its extra request are done
+         void next() {
+            // The polls start on their own, once the console had the time to boot
+            if ( pending == request_t::ready ) {
+               return;
+            }
+
+            bool poll_done = pending == request_t::custom or pending == request_t::wait;
+
+            if ( poll_done and cycle % profile->extra_every == 0 ) {
+               send_extra();
+            } else if ( chained() ) {
+               poll();
+            }
+         }
+
+         /// @brief Check a gesture follows the press of its code in time
+         void check_gesture(uint8_t code, uint8_t kind, bool press, uint16_t ts) {
+            uint16_t since = ts - pressed_at;
+
+            if ( not press or code != pressed_code ) {
+               fail("key events: gesture %u of %u while %u is pressed", kind >> 5, code, pressed_code);
+            } else if ( kind == long_press ) {
+               if ( gesture_at or since < MUX_LONG_PRESS_MS or since > MUX_LONG_PRESS_MS + gesture_slack ) {
+                  fail("key events: long press of %u after %ums", code, since);
+               }
+
+               gesture_at = ts;
+               ++nb_long_presses;
+            } else if ( kind == repeat ) {
+               uint16_t period = ts - gesture_at;
+
+               if ( gesture_at == 0 or period + gesture_slack < MUX_REPEAT_MS or period > MUX_REPEAT_MS + gesture_slack ) {
+                  fail("key events: repeat of %u %ums after the last", code, period);
+               }
+
+               gesture_at = ts;
+               ++nb_repeats;
+            } else {
+               uint16_t gap = ts - released_at[code];
+
+               if ( since != 0 or gap > MUX_DOUBLE_PRESS_MS ) {
+                  fail("key events: double press of %u %ums after its release", code, gap);
+               }
+
+               ++nb_double_presses;
+            }
+         }
+
+         /// @brief Check the key events are in sequence and consistent
+         void check_events(const uint8_t *r, uint8_t size) {
+            uint16_t bytes = r[2] << 8 | r[3];
+            uint16_t registers = r[4] << 8 | r[5];
+
+            if ( bytes != size - 4 or registers * 2 + 2 != bytes or registers > 31 ) {
+               fail("key events: %u bytes for %u registers in a reply of %u", bytes, registers, size);
+               return;
+            }
+
+            for (uint8_t i = 6; i < size; i += 4) {
+               uint8_t sequence = r[i];
+               uint8_t code = r[i + 1] & 0x1f;
+               uint8_t kind = r[i + 1] & gesture_msk;
+               bool press = r[i + 1] & 0x80;
+               uint16_t ts = r[i + 2] << 8 | r[i + 3];
+
+               if ( events_started and sequence != next_sequence ) {
+                  fail("key events: sequence %u, expected %u", sequence, next_sequence);
+               }
+
+               if ( code < 1 or code > max_code ) {
+                  fail("key events: bad code %u", r[i + 1] & 0x7f);
+               } else if ( kind ) {
+                  check_gesture(code, kind, press, ts);
+               } else if ( press and pressed_code ) {
+                  fail("key events: press of %u while %u is pressed", code, pressed_code);
+               } else if ( not press and code != pressed_code ) {
+                  fail("key events: release of %u while %u is pressed", code, pressed_code);
+               }
+
+               trace("key event %u: %s %u (kind %u) at %ums", sequence, press ? "press" : "release", code, kind >> 5, ts);
+
+               events_started = true;
+               next_sequence = sequence + 1;
+
+               if ( kind == 0 ) {
+                  if ( press ) {
+                     pressed_at = ts;
+                     gesture_at = 0;
+                  } else if ( code <= max_code ) {
+                     released_at[code] = ts;
+                  }
+
+                  pressed_code = press ? code : 0;
+                  nb_presses += press;
+               }
+
+               ++nb_events;
+            }
+         }
+
+         /// @brief Check the content of a valid, non-exception reply
+         void check(const uint8_t *r, uint8_t size) {
+            auto expect_size = [&](uint8_t expected) {
+               if ( size != expected ) {
+                  fail("%s: reply of %u bytes, expected %u", names[size_t(pending)], size, expected);
+               }
+               return size == expected;
+            };
+
+            switch (pending) {
+            case request_t::ready:
+               if ( expect_size(3 + 2 * (ready_register - status_register + 1)) ) {
+                  if ( (r[3] << 8 | r[4]) & initialising ) {
+                     ++nb_initialising;
+                     at(now() + ready_retry, send_ready);
+                  } else {
+                     ready_at = now();
+                     ready_time = r[size - 2] << 8 | r[size - 1];
+
+                     if ( ready_time == 0 or ready_time * 1000ULL > now() ) {
+                        fail("ready: ready after %uus, reported at %.1fus", ready_time, now() / 1e3);
+                     }
+                  }
+               }
+               break;
+            case request_t::custom:
+               if ( expect_size(5) ) {
+                  panel::check_switches(r[2]);
+                  panel::check_key(r[3]);
+                  check_flags("custom", r[4]);
+                  apply_leds(now());
+               }
+               break;
+            case request_t::wait:
+               if ( expect_size(6) ) {
+                  change_sequence = r[2];
+                  panel::check_switches(r[3]);
+                  panel::check_key(r[4]);
+                  check_flags("wait", r[5]);
+                  apply_leds(sent_at); // Applied on reception, not on the reply
+               }
+               break;
+            case request_t::read_coils:
+               if ( expect_size(5) and leds_valid ) {
+                  uint16_t coils = r[3] | (r[4] << 8);
+
+                  if ( coils != leds_applied ) {
+                     fail("read coils: got %03x, expected %03x", coils, leds_applied);
+                  }
+               }
+               break;
+            case request_t::write_coils:
+               if ( expect_size(6) ) {
+                  apply_leds(now());
+               }
+               break;
+            case request_t::read_key:
+               if ( expect_size(5) ) {
+                  panel::check_key(r[4]);
+               }
+               break;
+            case request_t::buzzer:
+               expect_size(6);
+               break;
+            case request_t::tune:
+               tune_uploaded = expect_size(6) and r[3] == tune_register and r[5] == tune_size + 2;
+               break;
+            case request_t::key_events:
+               check_events(r, size);
+               break;
+            case request_t::effect:
+               if ( expect_size(6) ) {
+                  if ( blinking and now() - blink_started > 4 * blink_half_period and blink_toggles < 2 and
+                       not i2c::disturbed(blink_started) )
+                  {
+                     fail("effect: LED %u did not blink", blink_led);
+                  }
+
+                  nb_blink_toggles += blinking ? blink_toggles : 0;
+                  blinking = not blinking;
+                  blink_started = now();
+                  blink_toggles = 0;
+                  blink_state = panel::get_leds() & 1U << blink_led;
+               }
+               break;
+            case request_t::dim:
+               if ( expect_size(6) ) {
+                  account_dim(now());
+
+                  // The measured duty cycle of the LED while lit must match its brightness
+                  if ( dimmed and dim_expected > dim_min_time and not i2c::disturbed(dim_started) ) {
+                     double duty = double(panel::get_lit_time(dim_led) - dim_lit_start) / dim_expected;
+
+                     if ( duty < dim_level / 15.0 - dim_tolerance or duty > dim_level / 15.0 + dim_tolerance ) {
+                        fail("dim: LED %u lit %.1f%% of the time, expected %.1f%%", dim_led, 100 * duty, 100 * dim_level / 15.0);
+                     }
+
+                     dim_duty_min = std::min(dim_duty_min, duty);
+                     dim_duty_max = std::max(dim_duty_max, duty);
+                  }
+
+                  dimmed = not dimmed;
+                  dim_expected = 0;
+                  dim_lit_start = panel::get_lit_time(dim_led);
+                  dim_started = now();
+               }
+               break;
+            case request_t::diagnostics:
+               if ( diag_clear ) {
+                  if ( expect_size(6) ) {
+                     diag_frames = diag_not_for_me = diag_exceptions = 0;
+                  }
+               } else if ( expect_size(3 + 2 * (diag_count - 1)) ) {
+                  for (uint8_t i = 1; i < diag_count; ++i) {
+                     diag_last[i] = r[1 + i * 2] << 8 | r[2 + i * 2];
+                  }
+
+                  diag_read = true;
+
+                  if ( diag_last[1] != diag_frames or diag_last[2] != diag_not_for_me or
+                       diag_last[3] != 0 or diag_last[4] != diag_exceptions or (diag_last[6] != 0 and not faults_expected()) )
+                  {
+                     fail("diagnostics: frames %u/%u/%u exceptions %u i2c errors %u, expected %u/%u/0 %u 0",
+                        diag_last[1], diag_last[2], diag_last[3], diag_last[4], diag_last[6],
+                        diag_frames, diag_not_for_me, diag_exceptions);
+                  }
+
+                  if ( diag_last[diag_expander_errors] + diag_last[diag_expander_errors + 1] != diag_last[6] ) {
+                     fail("diagnostics: i2c errors %u, %u/%u per expander", diag_last[6],
+                        diag_last[diag_expander_errors], diag_last[diag_expander_errors + 1]);
+                  }
+               }
+
+               diag_clear = not diag_clear;
+               break;
+            case request_t::readdress:
+               // Replied from the previous address
+               if ( expect_size(6) ) {
+                  device = r[5];
+               }
+               break;
+            case request_t::baud:
+               if ( expect_size(6) and r[5] == baud_next ) {
+                  if ( baud_committing ) {
+                     baud_committing = false;
+                     baud_code = baud_next;
+                     ++nb_baud_commits;
+                     quiet_until = 0;
+                  } else if ( rng() % 4 == 0 ) {
+                     // Stay at the previous rate, and wait for the console to come back to it
+                     ++nb_baud_reverts;
+                     quiet_until = now() + baud_switch_delay + baud_commit_window + response_timeout;
+                     panel::excuse(now(), quiet_until);
+
+                     if ( chained() ) {
+                        at(quiet_until, poll);
+                     }
+                  } else {
+                     // Follow, and commit at the new rate once the console has switched
+                     rs485::master_configure(baud_rates[baud_next]);
+                     baud_committing = true;
+                     quiet_until = now() + baud_switch_delay + 2 * response_timeout;
+
+                     at(now() + baud_switch_delay + response_timeout, [] {
+                        send(request_t::baud, {device, 6, 0, baud_register, 0, baud_next});
+                     });
+                  }
+               }
+               break;
+            case request_t::read_write:
+               if ( expect_size(17) ) {
+                  uint16_t coils = r[3] << 8 | r[4];
+
+                  if ( r[2] != 14 or coils != leds ) {
+                     fail("read write: %u bytes, LEDs %03x, expected %03x", r[2], coils, leds);
+                  }
+
+                  panel::check_key(r[10]);
+                  panel::check_switches(r[12]);
+                  apply_leds(now());
+                  check_flags("read write", r[13] << 8 | r[14]);
+               }
+               break;
+            default:
+               break;
+            }
+         }
+
+         void on_reply() {
+            auto &s = stats[size_t(pending)];
+            auto rtt = now() - sent_at;
+
+            if ( pending == request_t::other_node ) {
+               fail("the console replied to a frame for node %u", other_device);
+               return;
+            }
+
+            if ( pending == request_t::broadcast ) {
+               fail("the console replied to a broadcast");
+               return;
+            }
+
+            if ( reply_size < 4 or crc16(reply, reply_size) != 0 ) {
+               ++s.bad_crc;
+               fail("%s: reply with a bad CRC", names[size_t(pending)]);
+               return;
+            }
+
+            ++s.replies;
+            s.rtt_total += rtt;
+            s.rtt_min = (s.rtt_min == 0 or rtt < s.rtt_min) ? rtt : s.rtt_min;
+            s.rtt_max = rtt > s.rtt_max ? rtt : s.rtt_max;
+
+            // The long poll is held on purpose, it would only blur the histogram
+            if ( pending != request_t::wait ) {
+               uint8_t bin = 0;
+
+               for (auto limit = rtt_base; rtt >= limit and bin < rtt_bins - 1; limit *= 2) {
+                  ++bin;
+               }
+
+               ++rtt_histogram[bin];
+               rtts.push_back(rtt);
+            }
+
+            if ( reply[0] != device or (reply[1] & 0x7f) != request[1] ) {
+               fail("%s: reply from %u for function %u", names[size_t(pending)], reply[0], reply[1]);
+            } else if ( reply[1] & 0x80 ) {
+               ++s.exceptions;
+               ++diag_exceptions;
+               trace("%s: exception %u", names[size_t(pending)], reply[2]);
+
+               if ( pending == request_t::bad_address and reply[2] != 2 ) {
+                  fail("%s: exception %u, expected illegal data address", names[size_t(pending)], reply[2]);
+               }
+            } else if ( pending == request_t::bad_address ) {
+               fail("%s: the request was accepted", names[size_t(pending)]);
+            } else {
+               check(reply, reply_size - 2);
+            }
+
+            next();
+         }
+
+         void on_silence() {
+            auto &s = stats[size_t(pending)];
+
+            if ( pending == request_t::broadcast ) {
+               if ( broadcast_leds ) {
+                  apply_leds(sent_at);
+                  leds_checked_from = sent_at + response_timeout + options.handler_latency;
+               }
+            } else if ( pending != request_t::other_node ) {
+               ++s.timeouts;
+               fail("%s: no reply", names[size_t(pending)]);
+            }
+
+            next();
+         }
+
+         void on_receive(uint8_t c) {
+            auto started = now() - rs485::master_char_time();
+
+            if ( reply_size == 0 and started < sent_at + t3_5() ) {
+               ++nb_early_replies;
+               fail("%s: reply started %.1fus after the request, before T3.5", names[size_t(pending)], (started - sent_at) / 1e3);
+            } else if ( reply_size != 0 and started - last_received > t1_5() ) {
+               ++nb_gapped_replies;
+               fail("%s: silence of %.1fus within the reply, over T1.5", names[size_t(pending)], (started - last_received) / 1e3);
+            }
+
+            last_received = now();
+
+            if ( reply_size < sizeof(reply) ) {
+               reply[reply_size++] = c;
+            }
+
+            // End of the reply once the line is silent for T3.5
+            at(now() + t3_5(), [gen = ++generation] {
+               if ( gen == generation ) {
+                  on_reply();
+               }
+            });
+         }
+      }
+
+      bool set_profile(const char *name) {
+         for (auto &p : profiles) {
+            if ( strcmp(p.name, name) == 0 ) {
+               profile = &p;
+               return true;
+            }
+         }
+
+         return false;
+      }
+
+      void start() {
+         rng.seed(options.seed);
+         rs485::master_on_receive(on_receive);
+
+         // Served at once, until the console reports it is ready
+         at(0, send_ready);
+
+         // Let the console boot
+         at(ns(std::chrono::milliseconds{50}), poll);
+      }
+
+      void save(FILE *f) {
+         auto totals = get_totals();
+         auto seconds = now() / 1e9;
+
+         fprintf(f, "  \"profile\": \"%s\",\n", profile->name);
+         fprintf(f, "  \"baud\": %u,\n", baud_rates[baud_code]);
+         fprintf(f, "  \"ready_us\": %u,\n", ready_time);
+         fprintf(f, "  \"requests_per_s\": %.1f,\n", totals.sent / seconds);
+         fprintf(f, "  \"replies_per_s\": %.1f,\n", totals.replies / seconds);
+         fprintf(f, "  \"exception_rate\": %.6f,\n", percent(totals.exceptions, totals.replies) / 100);
+         fprintf(f, "  \"bad_crc_rate\": %.6f,\n", percent(totals.bad_crc, totals.replies) / 100);
+         fprintf(f, "  \"timeout_rate\": %.6f,\n", percent(totals.timeouts, totals.replies) / 100);
+         fprintf(f, "  \"early_replies\": %llu,\n", (unsigned long long)nb_early_replies);
+         fprintf(f, "  \"gapped_replies\": %llu,\n", (unsigned long long)nb_gapped_replies);
+         fprintf(f, "  \"rtt_us\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f},\n",
+            percentile(0.5) / 1e3, percentile(0.9) / 1e3, percentile(0.99) / 1e3);
+         fprintf(f, "  \"rtt_histogram\": {\"base_us\": %u, \"bins\": [", unsigned(rtt_base / 1000));
+
+         for (uint8_t i = 0; i < rtt_bins; ++i) {
+            fprintf(f, "%s%llu", i ? ", " : "", (unsigned long long)rtt_histogram[i]);
+         }
+
+         fprintf(f, "]},\n");
+         fprintf(f, "  \"requests\": {");
+
+         for (size_t i = 0; i < size_t(request_t::count); ++i) {
+            auto &s = stats[i];
+
+            fprintf(f, "%s\n    \"%s\": {\"sent\": %llu, \"replies\": %llu, \"exceptions\": %llu, "
+               "\"timeouts\": %llu, \"bad_crc\": %llu, \"rtt_min_us\": %.1f, \"rtt_mean_us\": %.1f, \"rtt_max_us\": %.1f}",
+               i ? "," : "", names[i],
+               (unsigned long long)s.sent, (unsigned long long)s.replies,
+               (unsigned long long)s.exceptions, (unsigned long long)s.timeouts,
+               (unsigned long long)s.bad_crc,
+               s.rtt_min / 1e3, s.replies ? s.rtt_total / 1e3 / s.replies : 0.0, s.rtt_max / 1e3);
+         }
+
+         fprintf(f, "\n  }");
+      }
+
+      void report() {
+         printf("Modbus master:\n");
+         printf("  %-12s %8s %8s %8s %8s %8s %10s %10s %10s\n",
+            "request", "sent", "replies", "except.", "timeout", "bad crc", "rtt min", "rtt mean", "rtt max");
+
+         for (size_t i = 0; i < size_t(request_t::count); ++i) {
+            auto &s = stats[i];
+
+            printf("  %-12s %8llu %8llu %8llu %8llu %8llu %8.1fus %8.1fus %8.1fus\n",
+               names[i],
+               (unsigned long long)s.sent, (unsigned long long)s.replies,
+               (unsigned long long)s.exceptions, (unsigned long long)s.timeouts,
+               (unsigned long long)s.bad_crc,
+               s.rtt_min / 1e3, s.replies ? s.rtt_total / 1e3 / s.replies : 0.0, s.rtt_max / 1e3);
+         }
+
+         auto totals = get_totals();
+         auto seconds = now() / 1e9;
+
+         printf("  profile %s, %.1f requests/s, %.1f replies/s\n", profile->name, totals.sent / seconds, totals.replies / seconds);
+         printf("  exceptions %.3f%%, bad crc %.3f%%, timeouts %.3f%% of the replies\n",
+            percent(totals.exceptions, totals.replies), percent(totals.bad_crc, totals.replies), percent(totals.timeouts, totals.replies));
+         printf("  replies before T3.5 %llu, with a gap over T1.5 %llu\n",
+            (unsigned long long)nb_early_replies, (unsigned long long)nb_gapped_replies);
+         printf("  rtt p50 %.1fus, p90 %.1fus, p99 %.1fus, <%u:%llu",
+            percentile(0.5) / 1e3, percentile(0.9) / 1e3, percentile(0.99) / 1e3,
+            unsigned(rtt_base / 1000), (unsigned long long)rtt_histogram[0]);
+
+         for (uint8_t i = 1; i < rtt_bins - 1; ++i) {
+            printf(" <%u:%llu", unsigned((rtt_base << i) / 1000), (unsigned long long)rtt_histogram[i]);
+         }
+
+         printf(" >=%u:%llu (us)\n", unsigned((rtt_base << (rtt_bins - 2)) / 1000), (unsigned long long)rtt_histogram[rtt_bins - 1]);
+         printf("  console ready after %uus, replies while initialising %llu\n", ready_time, (unsigned long long)nb_initialising);
+         printf("  key events read %llu, presses %llu, long presses %llu, repeats %llu, double presses %llu\n",
+            (unsigned long long)nb_events, (unsigned long long)nb_presses, (unsigned long long)nb_long_presses,
+            (unsigned long long)nb_repeats, (unsigned long long)nb_double_presses);
+
+         if ( ready_at == 0 ) {
+            fail("the console never reported ready");
+         }
+
+         if ( options.dead_expander >= 0 and nb_i2c_faults == 0 ) {
+            fail("the dead expander was never reported as an I2C fault");
+         }
+         printf("  line rate %u baud, changes committed %llu, reverted %llu\n", baud_rates[baud_code],
+            (unsigned long long)nb_baud_commits, (unsigned long long)nb_baud_reverts);
+         printf("  blink toggles seen %llu, tunes checked %llu\n",
+            (unsigned long long)nb_blink_toggles, (unsigned long long)nb_tunes_checked);
+
+         if ( dim_duty_min <= dim_duty_max ) {
+            printf("  dimmed LED duty %.1f%% to %.1f%%, expected %.1f%%\n",
+               100 * dim_duty_min, 100 * dim_duty_max, 100 * dim_level / 15.0);
+         }
+
+         // As a fleet tool would show them
+         if ( diag_read ) {
+            auto histogram = [](const char *name, const uint16_t *bins, uint16_t max, unsigned base) {
+               printf("  %s: max %uus, <%u:%u", name, max, base, bins[0]);
+
+               for (uint8_t i = 1; i < 7; ++i, base <<= 1) {
+                  printf(" <%u:%u", base * 2, bins[i]);
+               }
+
+               printf(" >=%u:%u\n", base, bins[7]);
+            };
+
+            printf("  console counters: i2c transfers %u, errors %u/%u, recoveries %u/%u, replies with a fault %llu\n",
+               diag_last[5], diag_last[diag_expander_errors], diag_last[diag_expander_errors + 1],
+               diag_last[diag_expander_recoveries], diag_last[diag_expander_recoveries + 1], (unsigned long long)nb_i2c_faults);
+            histogram("poll lateness", &diag_last[8], diag_last[7], 64);
+            histogram("turnaround", &diag_last[17], diag_last[16], 16);
+         }
+      }
+   }
+}
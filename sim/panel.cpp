@@ -0,0 +1,372 @@
+/**
+ * Simulation of the operator panel
+ * The operator presses random keys (possibly with shift) and flips the override switches. Now
+ *  and then, a key is held long enough to repeat, tapped twice, or pressed together with
+ *  another one as a chord of the board.
+ * Contacts bounce for a couple of milliseconds on every edge.
+ * The key codes and switch states reported over Modbus are checked against the operator actions.
+ *  A key of a chord may be reported late by the time it is held back for the chord.
+ */
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include <conf_mux.h>
+#include <conf_mux_board.hpp>
+
+#include "sim.hpp"
+
+namespace sim {
+   namespace panel {
+      namespace {
+         using std::chrono::milliseconds;
+         using std::chrono::microseconds;
+
+         // Expanders and ports
+         constexpr uint8_t left = 0;
+         constexpr uint8_t right = 1;
+         constexpr uint8_t leds_port = 0;
+         constexpr uint8_t inputs_port = 1;
+
+         // Right side inputs
+         constexpr uint8_t switches_msk = 0b1111;
+         constexpr uint8_t door_msk = 1U << 4;
+         constexpr uint8_t shift_msk = 1U << 5;
+
+         constexpr auto bounce_time = ns(milliseconds{2});
+         constexpr auto bounce_step = ns(microseconds{250});
+
+         /// Worst case from a stable contact to the value being available to the master
+         constexpr auto max_latency = ns(milliseconds{15});
+
+         using layout = console::mux::Layout<board::Panel>;
+         constexpr auto nb_keys = layout::nb_keys;
+
+         // Gestures
+         constexpr auto long_hold_min = ns(milliseconds{MUX_LONG_PRESS_MS + 100});
+         constexpr auto long_hold_max = ns(milliseconds{MUX_LONG_PRESS_MS + 1500});
+         constexpr auto tap_gap_min = ns(milliseconds{MUX_DOUBLE_PRESS_MS / 4});
+         constexpr auto tap_gap_max = ns(milliseconds{MUX_DOUBLE_PRESS_MS / 2});
+         constexpr auto chord_stagger = ns(milliseconds{3}); ///< Most time between the keys of a chord
+         constexpr auto chord_delay = ns(milliseconds{MUX_CHORD_MS});
+
+         struct Press {
+            time_t pressed;
+            time_t released; ///< Set once released
+            uint8_t code;
+            time_t seen;     ///< Time first reported, 0 if never
+            time_t latency;  ///< Most time for the press or release to be reported
+         };
+
+         /// @return The keys part of a chord, which the device holds back
+         constexpr uint16_t chord_keys() {
+            uint16_t keys = 0;
+
+            for (auto chord : layout::chords) {
+               keys |= chord;
+            }
+
+            return keys;
+         }
+
+         /// Contacts of a key or a chord
+         struct Keys {
+            uint8_t code;
+            bool shift;
+            uint8_t nb;
+            uint8_t side[2];
+            uint8_t msk[2];
+            time_t latency;
+         };
+
+         std::mt19937 rng;
+         std::vector<Press> presses;
+
+         // Logical state of the contacts, 1 is active
+         uint8_t keys[2];
+         uint8_t switches;
+         time_t switches_changed;
+
+         uint64_t nb_switch_changes;
+
+         /// Times the master did not poll
+         std::vector<std::pair<time_t, time_t>> excused;
+         uint64_t nb_excused;
+
+         // LEDs as last driven, and their lit time up to then
+         uint16_t shown;
+         time_t shown_since;
+         time_t lit_time[12];
+
+         bool is_excused(const Press &p) {
+            auto released = p.released ? p.released : now();
+
+            for (auto &[from, to] : excused) {
+               if ( p.pressed <= to and released >= from ) {
+                  return true;
+               }
+            }
+
+            return false;
+         }
+
+         /// @return Time the press must be reported by, counted from the inputs being sampled again
+         ///  if they were not before it was
+         time_t deadline(const Press &p) {
+            auto from = p.pressed;
+
+            for (auto &[start, to] : excused) {
+               if ( p.pressed + p.latency >= start and p.pressed <= to and to > from ) {
+                  from = to;
+               }
+            }
+
+            return from + p.latency;
+         }
+
+         time_t random(time_t min, time_t max) {
+            return min + rng() % (max - min);
+         }
+
+         /// Switches are active low, the expander polarity inverts them back
+         void drive(uint8_t side) {
+            auto pins = keys[side];
+
+            if ( side == right ) {
+               pins |= ~switches & switches_msk;
+            }
+
+            i2c::set_pins(side, inputs_port, pins);
+         }
+
+         /// @brief Change a contact, bouncing before it settles
+         void contact(uint8_t side, uint8_t msk, bool active) {
+            for (auto t = time_t{0}; t < bounce_time; t += bounce_step) {
+               after(t, [=] {
+                  keys[side] = (rng() & 1) ? keys[side] | msk : keys[side] & ~msk;
+                  drive(side);
+               });
+            }
+
+            after(bounce_time, [=] {
+               keys[side] = active ? keys[side] | msk : keys[side] & ~msk;
+               drive(side);
+            });
+         }
+
+         void next_press();
+
+         /// @brief Press the contacts of a key, or of a chord one after the other, then release them
+         /// @return Time until all are released
+         time_t hold(const Keys &k, time_t duration) {
+            auto shift_lead = k.shift ? ns(milliseconds{20}) : 0;
+
+            if ( k.shift ) {
+               contact(right, shift_msk, true);
+            }
+
+            after(shift_lead, [=] {
+               presses.push_back(Press{now(), 0, k.code, 0, k.latency});
+               trace("panel: press key %u", k.code);
+
+               for (uint8_t i = 0; i < k.nb; ++i) {
+                  after(i ? random(0, chord_stagger) : 0, [=] { contact(k.side[i], k.msk[i], true); });
+               }
+            });
+
+            after(shift_lead + duration, [=] {
+               presses.back().released = now() + bounce_time;
+               trace("panel: release key %u", k.code);
+
+               for (uint8_t i = 0; i < k.nb; ++i) {
+                  contact(k.side[i], k.msk[i], false);
+               }
+            });
+
+            if ( k.shift ) {
+               after(2 * shift_lead + duration, [] { contact(right, shift_msk, false); });
+            }
+
+            return 2 * shift_lead + duration + bounce_time;
+         }
+
+         void press() {
+            auto gesture = rng() % 10;
+            Keys k{};
+
+            if ( gesture == 0 and layout::nb_chords ) {
+               auto chord = rng() % layout::nb_chords;
+
+               k.code = 2 * nb_keys + 1 + chord;
+               k.latency = max_latency;
+
+               for (uint8_t key = 0; key < nb_keys; ++key) {
+                  if ( layout::chords[chord] & (1U << key) ) {
+                     k.side[k.nb] = left;
+                     k.msk[k.nb++] = 1U << key;
+                  }
+               }
+            } else {
+               auto index = rng() % 7; // 6 keys on the left, the door key on the right
+               bool held_back = chord_keys() & (1U << index);
+
+               k.shift = rng() % 3 == 0;
+               k.code = index + 1 + (k.shift ? nb_keys : 0);
+               k.nb = 1;
+               k.side[0] = index < 6 ? left : right;
+               k.msk[0] = index < 6 ? 1U << index : door_msk;
+               k.latency = max_latency + (held_back ? chord_delay : 0);
+            }
+
+            if ( gesture == 1 ) {
+               after(hold(k, random(long_hold_min, long_hold_max)), next_press);
+            } else if ( gesture == 2 ) {
+               // Tapped twice, the second press follows the release of the first
+               auto end = hold(k, random(ns(milliseconds{60}), ns(milliseconds{150})));
+
+               after(end + random(tap_gap_min, tap_gap_max), [k] {
+                  after(hold(k, random(ns(milliseconds{60}), ns(milliseconds{300}))), next_press);
+               });
+            } else {
+               after(hold(k, random(ns(milliseconds{60}), ns(milliseconds{600}))), next_press);
+            }
+         }
+
+         void next_press() {
+            after(random(ns(milliseconds{60}), ns(milliseconds{400})), press);
+         }
+
+         void flip_switch() {
+            auto msk = uint8_t(1U << (rng() % 4));
+
+            switches ^= msk;
+            switches_changed = now();
+            ++nb_switch_changes;
+            trace("panel: switches %x", switches);
+
+            // Bounce through the polarity of the right side
+            for (auto t = time_t{0}; t < bounce_time; t += bounce_step) {
+               after(t, [msk] {
+                  auto pins = keys[right] | (~switches & switches_msk);
+                  i2c::set_pins(right, inputs_port, (rng() & 1) ? pins ^ msk : pins);
+               });
+            }
+
+            after(bounce_time, [] { drive(right); });
+            after(random(ns(std::chrono::seconds{1}), ns(std::chrono::seconds{5})), flip_switch);
+         }
+      }
+
+      void start() {
+         rng.seed(options.seed * 7919);
+         drive(left);
+         drive(right);
+
+         after(ns(milliseconds{100}), next_press);
+         after(ns(std::chrono::seconds{1}), flip_switch);
+      }
+
+      void check_key(uint8_t code) {
+         auto t = now();
+
+         // The inputs of an expander out of service hold their last state
+         if ( i2c::disturbed() ) {
+            return;
+         }
+
+         // Find the press the code could belong to
+         for (auto it = presses.rbegin(); it != presses.rend(); ++it) {
+            auto &p = *it;
+            auto released = p.released ? p.released : t;
+
+            if ( code == 0 ) {
+               // The press being held for long must be reported
+               if ( p.released == 0 and t > deadline(p) ) {
+                  fail("key %u pressed %.1fms ago is not reported",
+                     p.code, (t - p.pressed) / 1e6);
+               }
+               return;
+            }
+
+            if ( p.code == code and t >= p.pressed and t <= released + p.latency ) {
+               if ( p.seen == 0 ) {
+                  p.seen = t;
+               }
+               return;
+            }
+
+            if ( released + p.latency < t ) {
+               break;
+            }
+         }
+
+         // A press overlapping an I2C fault may be seen without its shift, or the shift alone
+         if ( code != 0 and not (options.i2c_faults > 0 and not presses.empty() and is_excused(presses.back())) ) {
+            fail("key %u reported but not pressed", code);
+         }
+      }
+
+      void excuse(time_t from, time_t to) {
+         excused.push_back({from, to});
+      }
+
+      void check_switches(uint8_t status) {
+         if ( now() > switches_changed + max_latency and status != switches and not i2c::disturbed() ) {
+            fail("switches reported as %x, expected %x", status, switches);
+         }
+      }
+
+      uint16_t get_leds() {
+         return (i2c::get_outputs(left, leds_port) & 0x3f) << 6 | (i2c::get_outputs(right, leds_port) & 0x3f);
+      }
+
+      void on_outputs() {
+         for (uint8_t led = 0; led < 12; ++led) {
+            if ( shown & 1U << led ) {
+               lit_time[led] += now() - shown_since;
+            }
+         }
+
+         shown = get_leds();
+         shown_since = now();
+      }
+
+      time_t get_lit_time(uint8_t led) {
+         return lit_time[led] + (shown & 1U << led ? now() - shown_since : 0);
+      }
+
+      void check_leds(uint16_t expected, uint16_t ignored) {
+         uint16_t leds = get_leds();
+
+         if ( (leds ^ expected) & ~ignored ) {
+            fail("LEDs show %03x, expected %03x", leds, expected);
+         }
+      }
+
+      void report() {
+         uint64_t seen = 0;
+         time_t total = 0, min = 0, max = 0;
+
+         for (auto &p : presses) {
+            if ( p.seen ) {
+               auto latency = p.seen - p.pressed;
+               ++seen;
+               total += latency;
+               min = (min == 0 or latency < min) ? latency : min;
+               max = latency > max ? latency : max;
+            } else if ( is_excused(p) ) {
+               ++nb_excused;
+            } else if ( p.released and p.released + p.latency < now() ) {
+               fail("key %u pressed at %.3fs was never reported", p.code, p.pressed / 1e9);
+            }
+         }
+
+         printf("Operator panel:\n");
+         printf("  key presses %zu, reported %llu, unreported while not polled %llu, switch changes %llu\n",
+            presses.size(), (unsigned long long)seen, (unsigned long long)nb_excused,
+            (unsigned long long)nb_switch_changes);
+         printf("  key latency seen by the master: min %.1fms, mean %.1fms, max %.1fms\n",
+            min / 1e6, seen ? total / 1e6 / seen : 0.0, max / 1e6);
+      }
+   }
+}
@@ -0,0 +1,52 @@
+/**
+ * Simulation of the piezzo driver
+ * The notes are not played, only recorded with the time the piezzo sounds.
+ */
+#include <cstdio>
+#include <vector>
+
+#include "piezzo.hpp"
+#include "sim.hpp"
+
+namespace {
+   std::vector<uint16_t> notes;
+   uint16_t sounding = 0;
+   sim::time_t sounding_since;
+   sim::time_t sound_time = 0;
+}
+
+namespace console {
+   namespace piezzo {
+      void init() {}
+
+      void tone(uint16_t frequency) {
+         if ( sounding ) {
+            sound_time += sim::now() - sounding_since;
+         }
+
+         if ( frequency ) {
+            notes.push_back(frequency);
+            sim::trace("piezzo: %uHz", frequency);
+         }
+
+         sounding = frequency;
+         sounding_since = sim::now();
+      }
+   }
+}
+
+namespace sim {
+   namespace piezzo {
+      size_t get_note_count() {
+         return notes.size();
+      }
+
+      uint16_t get_note(size_t index) {
+         return notes[index];
+      }
+
+      void report() {
+         printf("Piezzo: %zu note(s) played, sounding %.1fs\n", notes.size(), sound_time / 1e9);
+      }
+   }
+}
@@ -0,0 +1,90 @@
+/**
+ * Simulation of the asx reactor
+ * Pending handlers are dispatched, highest priority first, before the virtual clock moves on.
+ */
+#include <vector>
+
+#include <alert.h>
+#include <asx/reactor.hpp>
+
+#include "sim.hpp"
+
+namespace asx {
+   namespace reactor {
+      namespace {
+         struct Slot {
+            handler_t handler;
+            reactor_priority_t prio;
+            bool pending;
+            uint32_t timer; ///< Generation of the timer, a stale timer is ignored
+         };
+
+         std::vector<Slot> slots;
+
+         sim::Probe probe_dispatch{"reactor handler"};
+
+         bool dispatch() {
+            Slot *next = nullptr;
+
+            for (auto &slot : slots) {
+               if ( slot.pending and (next == nullptr or slot.prio > next->prio) ) {
+                  next = &slot;
+               }
+            }
+
+            if ( next ) {
+               next->pending = false;
+               sim::Probe::Measure measure{probe_dispatch};
+               next->handler();
+            }
+
+            return next != nullptr;
+         }
+
+         void arm(uint8_t id, uint32_t timer, sim::time_t delay, sim::time_t period) {
+            sim::after(delay, [=] {
+               if ( slots[id].timer == timer ) {
+                  slots[id].pending = true;
+
+                  if ( period ) {
+                     arm(id, timer, period, period);
+                  }
+               }
+            });
+         }
+      }
+
+      void Handle::notify() {
+         alert_and_stop_if(id >= slots.size());
+         slots[id].pending = true;
+      }
+
+      void Handle::delay(std::chrono::nanoseconds delay) {
+         alert_and_stop_if(id >= slots.size());
+         arm(id, ++slots[id].timer, delay.count(), 0);
+      }
+
+      void Handle::repeat(std::chrono::nanoseconds period) {
+         alert_and_stop_if(id >= slots.size());
+         arm(id, ++slots[id].timer, period.count(), period.count());
+      }
+
+      void Handle::cancel() {
+         alert_and_stop_if(id >= slots.size());
+         ++slots[id].timer;
+      }
+
+      Handle bind(handler_t handler, reactor_priority_t prio) {
+         slots.push_back(Slot{handler, prio, false, 0});
+         return Handle(slots.size() - 1);
+      }
+
+      void run() {
+         do {
+            while ( dispatch() ) {}
+         } while ( sim::step() );
+
+         sim::finish();
+      }
+   }
+}
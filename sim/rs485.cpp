@@ -0,0 +1,125 @@
+/**
+ * Simulation of the RS485 half-duplex line
+ * Characters are delivered to the other end once fully transmitted.
+ * Both ends transmitting at the same time is a collision, and a failure.
+ * Each end has its own rate. A character sent at a rate the other end is not set to is a framing
+ *  error there, and is lost.
+ */
+#include <cstdio>
+
+#include "sim.hpp"
+
+namespace sim {
+   namespace rs485 {
+      namespace {
+         struct End {
+            uint32_t baud;
+            time_t char_duration;
+         } slave, master;
+
+         uint8_t bits = 0;
+         uint64_t baud_changes = 0;
+         uint64_t chars_lost = 0;
+         time_t line_free_at = 0;
+         time_t busy_total = 0;
+         uint64_t chars_from_master = 0;
+         uint64_t chars_from_slave = 0;
+
+         rx_handler_t slave_rx = nullptr;
+         std::function<void(uint8_t)> master_rx;
+
+         void set_baud(End &end, uint32_t rate) {
+            end.baud = rate;
+            end.char_duration = bits * 1000000000ULL / rate;
+         }
+
+         /// @return The time the transmission starts
+         time_t transmit(uint8_t size, time_t char_duration, const char *who) {
+            if ( now() < line_free_at ) {
+               fail("RS485 collision: the %s transmits while the line is busy", who);
+            }
+
+            auto duration = size * char_duration;
+
+            line_free_at = now() + duration;
+            busy_total += duration;
+
+            return now();
+         }
+      }
+
+      void configure(uint32_t rate, uint8_t bits_per_char) {
+         bits = bits_per_char;
+         baud_changes += slave.baud != 0 and rate != slave.baud;
+         set_baud(slave, rate);
+
+         // The master starts at the rate the console boots at
+         if ( master.baud == 0 ) {
+            set_baud(master, rate);
+         }
+      }
+
+      time_t char_time() {
+         return slave.char_duration;
+      }
+
+      uint32_t get_baud() {
+         return slave.baud;
+      }
+
+      void master_configure(uint32_t rate) {
+         set_baud(master, rate);
+      }
+
+      time_t master_char_time() {
+         return master.char_duration;
+      }
+
+      void slave_on_receive(rx_handler_t handler) {
+         slave_rx = handler;
+      }
+
+      void slave_send(const uint8_t *data, uint8_t size) {
+         auto start = transmit(size, slave.char_duration, "slave");
+         chars_from_slave += size;
+
+         for (uint8_t i = 0; i < size; ++i) {
+            at(start + (i + 1) * slave.char_duration, [c = data[i], rate = slave.baud] {
+               if ( rate != master.baud ) {
+                  ++chars_lost;
+               } else if ( master_rx ) {
+                  master_rx(c);
+               }
+            });
+         }
+      }
+
+      void master_on_receive(std::function<void(uint8_t)> handler) {
+         master_rx = std::move(handler);
+      }
+
+      void master_send(const uint8_t *data, uint8_t size) {
+         auto start = transmit(size, master.char_duration, "master");
+         chars_from_master += size;
+
+         for (uint8_t i = 0; i < size; ++i) {
+            at(start + (i + 1) * master.char_duration, [c = data[i], rate = master.baud] {
+               if ( rate != slave.baud ) {
+                  ++chars_lost;
+               } else if ( slave_rx ) {
+                  slave_rx(c);
+               }
+            });
+         }
+      }
+
+      void report() {
+         printf("RS485 line @%u baud:\n", slave.baud);
+         printf("  chars from master %llu, from slave %llu, lost to a rate mismatch %llu\n",
+            (unsigned long long)chars_from_master, (unsigned long long)chars_from_slave,
+            (unsigned long long)chars_lost);
+         printf("  rate changes of the console %llu\n", (unsigned long long)baud_changes);
+         printf("  line occupancy %.2f%%\n", now() ? 100.0 * busy_total / now() : 0.0);
+      }
+   }
+}
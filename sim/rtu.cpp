@@ -0,0 +1,76 @@
+/**
+ * Simulation of the line timing of the Modbus RTU slave
+ * The silences are timed on the virtual clock, in the ticks of the TCB. The frame handler is
+ *  measured against the --max-frame-ns budget, as it readies the reply.
+ * The handler is notified --handler-latency-us after the silence elapsed, as if the reactor was
+ *  busy. The characters received meanwhile must start the next frame.
+ * The events of the models never interrupt the firmware, so no interrupt needs masking.
+ * The rate is set on the RS485 line model.
+ */
+#include <asx/reactor.hpp>
+
+#include "rtu.hpp"
+#include "sim.hpp"
+
+namespace {
+   asx::reactor::handler_t frame_handler = nullptr;
+   asx::reactor::Handle react_on_silence;
+   sim::time_t restarted_at = 0;
+   sim::time_t silence = 0;
+   uint32_t generation = 0; ///< Invalidates the silences restarted since
+
+   sim::Probe probe_frame{"frame handler", &sim::options.max_frame_ns};
+
+   void on_silence() {
+      sim::Probe::Measure measure{probe_frame};
+      frame_handler();
+   }
+}
+
+namespace console {
+   namespace rtu {
+      void init(asx::reactor::handler_t on_silence) {
+         frame_handler = on_silence;
+         react_on_silence = asx::reactor::bind(::on_silence, reactor_prio_high);
+      }
+
+      void set_baud(uint32_t baud) {
+         sim::rs485::configure(baud, bits_per_char);
+      }
+
+      void restart(uint16_t ticks) {
+         restarted_at = sim::now();
+         silence = sim::time_t(ticks) * tick_ns;
+
+         sim::after(silence, [gen = ++generation] {
+            if ( gen != generation ) {
+               return;
+            }
+
+            if ( sim::options.handler_latency ) {
+               sim::after(sim::options.handler_latency, [] { react_on_silence.notify(); });
+            } else {
+               react_on_silence.notify();
+            }
+         });
+      }
+
+      asx::chrono::steady_clock::time_point silent_since() {
+         return asx::chrono::steady_clock::time_point{std::chrono::nanoseconds{restarted_at + silence}};
+      }
+
+      Critical::Critical() : sreg{0} {}
+
+      Critical::~Critical() {}
+
+      uint16_t elapsed() {
+         auto ticks = (sim::now() - restarted_at) / tick_ns;
+
+         if ( sim::now() - restarted_at >= silence or ticks >= 0xffff ) {
+            return 0xffff;
+         }
+
+         return ticks;
+      }
+   }
+}
@@ -0,0 +1,224 @@
+/**
+ * Simulation core: virtual clock, event queue, reporting and entry point
+ * The firmware main is renamed firmware_main when compiled for the simulation.
+ * It never returns: the reactor ends the simulation once its duration has elapsed.
+ */
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <vector>
+
+#include "sim.hpp"
+
+[[noreturn]] int firmware_main();
+
+namespace sim {
+   Options options = {
+      .duration = ns(std::chrono::seconds{60}),
+      .seed = 1,
+      .verbose = false,
+      .long_poll = false,
+      .max_frame_ns = 0,
+      .max_i2c_ns = 0,
+      .json = nullptr,
+      .i2c_faults = 0,
+      .dead_expander = -1,
+      .handler_latency = 0,
+   };
+
+   namespace {
+      struct Event {
+         time_t when;
+         uint64_t seq; // Keep the insertion order for simultaneous events
+         std::function<void()> what;
+
+         bool operator>(const Event &other) const {
+            return when != other.when ? when > other.when : seq > other.seq;
+         }
+      };
+
+      std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+      time_t current = 0;
+      uint64_t sequence = 0;
+      unsigned failures = 0;
+
+      constexpr auto max_failures_printed = 20U;
+
+      Probe *probes = nullptr;
+
+      void save() {
+         auto f = fopen(options.json, "w");
+
+         if ( not f ) {
+            fail("cannot write %s", options.json);
+            return;
+         }
+
+         fprintf(f, "{\n");
+         fprintf(f, "  \"seed\": %u,\n", options.seed);
+         fprintf(f, "  \"duration_s\": %.3f,\n", current / 1e9);
+         master::save(f);
+         fprintf(f, ",\n  \"failures\": %u\n}\n", failures);
+         fclose(f);
+      }
+
+      void usage(const char *prog) {
+         printf(
+            "Usage: %s [options]\n"
+            "  --duration <s>       Virtual time to simulate (default 60)\n"
+            "  --seed <n>           Seed of the random models (default 1)\n"
+            "  --max-frame-ns <ns>  Fail if building a reply costs more host time on average\n"
+            "  --max-i2c-ns <ns>    Fail if an I2C completion costs more host time on average\n"
+            "  --long-poll          Wait for the changes rather than polling every 20ms\n"
+            "  --profile <name>     Traffic of the master: full (default), production or saturate\n"
+            "  --json <file>        Save the results of the master to a file\n"
+            "  --i2c-faults <n>     Inject faults on the I2C bus, n per second on average\n"
+            "  --dead-expander <n>  Expander n never answers, from power-up\n"
+            "  --handler-latency-us <us>  Run the frame handler late, and follow the frames\n"
+            "                       without a reply at T3.5\n"
+            "  --verbose            Trace the frames and the key events\n", prog);
+      }
+   }
+
+   time_t now() {
+      return current;
+   }
+
+   void at(time_t when, std::function<void()> what) {
+      events.push(Event{when < current ? current : when, sequence++, std::move(what)});
+   }
+
+   bool step() {
+      if ( events.empty() or events.top().when > options.duration ) {
+         return false;
+      }
+
+      // The function is moved out before popping as it may schedule new events
+      auto event = std::move(const_cast<Event &>(events.top()));
+      events.pop();
+      current = event.when;
+      event.what();
+
+      return true;
+   }
+
+   void finish() {
+      printf("Simulated %.3fs\n", current / 1e9);
+      rs485::report();
+      master::report();
+      i2c::report();
+      panel::report();
+      piezzo::report();
+      Probe::report();
+
+      if ( options.json ) {
+         save();
+      }
+
+      if ( failures ) {
+         printf("%u check(s) failed\n", failures);
+         exit(1);
+      }
+
+      printf("All checks passed\n");
+      exit(0);
+   }
+
+   void fail(const char *fmt, ...) {
+      if ( ++failures <= max_failures_printed ) {
+         va_list args;
+         va_start(args, fmt);
+         printf("FAIL @%.6fs: ", current / 1e9);
+         vprintf(fmt, args);
+         printf("\n");
+         va_end(args);
+      }
+   }
+
+   void trace(const char *fmt, ...) {
+      if ( options.verbose ) {
+         va_list args;
+         va_start(args, fmt);
+         printf("%12.6f ", current / 1e9);
+         vprintf(fmt, args);
+         printf("\n");
+         va_end(args);
+      }
+   }
+
+   Probe::Probe(const char *name, const uint64_t *budget) : name{name}, budget{budget}, next{probes} {
+      probes = this;
+   }
+
+   void Probe::report() {
+      printf("Host cost of the firmware hot paths (ns):\n");
+      printf("  %-24s %12s %10s %10s\n", "path", "count", "mean", "max");
+
+      for (auto p = probes; p; p = p->next) {
+         auto mean = p->count ? p->total / p->count : 0;
+
+         printf("  %-24s %12llu %10llu %10llu\n",
+            p->name, (unsigned long long)p->count, (unsigned long long)mean, (unsigned long long)p->max);
+
+         if ( p->budget and *p->budget and mean > *p->budget ) {
+            fail("%s costs %llu ns, budget is %llu ns",
+               p->name, (unsigned long long)mean, (unsigned long long)*p->budget);
+         }
+      }
+   }
+}
+
+int main(int argc, char *argv[]) {
+   for (int i = 1; i < argc; ++i) {
+      auto arg = argv[i];
+      auto value = [&]() -> const char * {
+         if ( i + 1 >= argc ) {
+            sim::usage(argv[0]);
+            exit(2);
+         }
+         return argv[++i];
+      };
+
+      if ( strcmp(arg, "--duration") == 0 ) {
+         sim::options.duration = static_cast<sim::time_t>(atof(value()) * 1e9);
+      } else if ( strcmp(arg, "--seed") == 0 ) {
+         sim::options.seed = strtoul(value(), nullptr, 0);
+      } else if ( strcmp(arg, "--max-frame-ns") == 0 ) {
+         sim::options.max_frame_ns = strtoull(value(), nullptr, 0);
+      } else if ( strcmp(arg, "--max-i2c-ns") == 0 ) {
+         sim::options.max_i2c_ns = strtoull(value(), nullptr, 0);
+      } else if ( strcmp(arg, "--long-poll") == 0 ) {
+         sim::options.long_poll = true;
+      } else if ( strcmp(arg, "--profile") == 0 ) {
+         if ( not sim::master::set_profile(value()) ) {
+            sim::usage(argv[0]);
+            return 2;
+         }
+      } else if ( strcmp(arg, "--json") == 0 ) {
+         sim::options.json = value();
+      } else if ( strcmp(arg, "--i2c-faults") == 0 ) {
+         sim::options.i2c_faults = atof(value());
+      } else if ( strcmp(arg, "--dead-expander") == 0 ) {
+         sim::options.dead_expander = atoi(value());
+      } else if ( strcmp(arg, "--handler-latency-us") == 0 ) {
+         sim::options.handler_latency = static_cast<sim::time_t>(atof(value()) * 1e3);
+      } else if ( strcmp(arg, "--verbose") == 0 ) {
+         sim::options.verbose = true;
+      } else {
+         sim::usage(argv[0]);
+         return 2;
+      }
+   }
+
+   // The models start once the firmware has initialised
+   sim::at(0, [] {
+      sim::panel::start();
+      sim::master::start();
+      sim::i2c::start();
+   });
+
+   // Never returns, the simulation ends from the reactor
+   firmware_main();
+}
@@ -0,0 +1,180 @@
+#pragma once
+/**
+ * Host simulation of the console
+ * The firmware sources are compiled for Linux against the stand-ins found in standin/include
+ *  (shared with the benchmark, built with SIM defined) and sim/include.
+ * All hardware (I2C expanders, RS485 line, piezzo) is modelled and driven by a virtual clock,
+ *  so hours of operation run in seconds.
+ * The virtual time is expressed in nanoseconds since power-up.
+ */
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+
+namespace sim {
+   using time_t = uint64_t;
+
+   constexpr time_t ns(std::chrono::nanoseconds d) { return d.count(); }
+
+   /// @return The current virtual time
+   time_t now();
+
+   /// @brief Schedule a model event (the equivalent of an interrupt) at an absolute time
+   void at(time_t when, std::function<void()> what);
+
+   /// @brief Schedule a model event relative to now
+   inline void after(time_t delay, std::function<void()> what) {
+      at(now() + delay, std::move(what));
+   }
+
+   /// @brief Run the next model event
+   /// @return false once the simulation end time has been reached
+   bool step();
+
+   /// @brief Print the reports and exit with the result of the checks
+   [[noreturn]] void finish();
+
+   /// @brief Record a check failure. Only the first few are printed.
+   void fail(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+   /// @brief Trace a model event when running verbose
+   void trace(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+   /// Command line options
+   struct Options {
+      time_t duration;        ///< Virtual time to simulate
+      uint32_t seed;          ///< Seed for the operator and master random models
+      bool verbose;           ///< Trace all frames and key events
+      bool long_poll;         ///< The master waits for changes rather than polling
+      uint64_t max_frame_ns;  ///< Host cost budget to build a reply (0 = no budget)
+      uint64_t max_i2c_ns;    ///< Host cost budget per I2C completion (0 = no budget)
+      const char *json;       ///< File to save the results to, for the builds to be compared
+      double i2c_faults;      ///< Faults injected on the I2C bus per second (0 = none)
+      int dead_expander;      ///< Expander which never answers, from power-up (-1 = none)
+      time_t handler_latency; ///< Delay from the end of a frame to its handler, the master sending back to back
+   };
+
+   extern Options options;
+
+   /// @brief Host cost of a firmware hot path, measured in wall-clock nanoseconds
+   class Probe {
+      const char *name;
+      const uint64_t *budget;
+      uint64_t count = 0;
+      uint64_t total = 0;
+      uint64_t max = 0;
+      Probe *next;
+
+   public:
+      /// @param budget Optional budget for the mean cost, checked in the report
+      explicit Probe(const char *name, const uint64_t *budget = nullptr);
+
+      void add(uint64_t cost) {
+         ++count;
+         total += cost;
+         max = cost > max ? cost : max;
+      }
+
+      /// @brief Print all probes and check their budget
+      static void report();
+
+      /// RAII measure of a scope
+      class Measure {
+         Probe &probe;
+         std::chrono::steady_clock::time_point start;
+      public:
+         explicit Measure(Probe &p) : probe{p}, start{std::chrono::steady_clock::now()} {}
+         ~Measure() {
+            probe.add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - start).count());
+         }
+      };
+   };
+
+   /// Operator side: keys, switches and the visible LEDs
+   namespace panel {
+      void start();
+      /// @brief Check a key code reported to the master at the current time
+      void check_key(uint8_t code);
+      /// @brief The master does not poll for a while, the presses in between may go unreported
+      void excuse(time_t from, time_t to);
+      /// @brief Check a switch status reported to the master at the current time
+      void check_switches(uint8_t status);
+      /// @return The LEDs currently driven by the expanders
+      uint16_t get_leds();
+      /// @brief Check the LEDs currently driven by the expanders, but the ignored ones
+      void check_leds(uint16_t expected, uint16_t ignored = 0);
+      /// @brief The expander outputs were written
+      void on_outputs();
+      /// @return Total time an LED has been lit since power-up
+      time_t get_lit_time(uint8_t led);
+      void report();
+   }
+
+   /// Modbus master on the RS485 line
+   namespace master {
+      /// @brief Select the traffic: full, production or saturate
+      /// @return false if the profile is unknown
+      bool set_profile(const char *name);
+      void start();
+      void report();
+      /// @brief Write the results as members of a JSON object
+      void save(FILE *f);
+   }
+
+   /// I2C bus with the two PCA9555 expanders, their /INT outputs wired together
+   namespace i2c {
+      /// @brief Start injecting the faults
+      void start();
+      /// @return A fault hit the expanders since a time, or they have not settled since the last one
+      bool disturbed(time_t since = now());
+      /// @brief Drive the input pins of an expander port
+      void set_pins(uint8_t chip, uint8_t port, uint8_t value);
+      /// @return The output pins of an expander port (only the ones configured as outputs)
+      uint8_t get_outputs(uint8_t chip, uint8_t port);
+      void report();
+   }
+
+   /// MCU pins driven by the models
+   namespace ioport {
+      /// @brief Drive a pin, as an open drain output would
+      void drive(uint8_t pin, bool level);
+   }
+
+   /// RS485 line
+   namespace rs485 {
+      using rx_handler_t = void (*)(uint8_t);
+
+      /// @brief Set the line format of the slave UART, the master follows the first one
+      void configure(uint32_t baud, uint8_t bits_per_char);
+      /// @return Time for the slave to transmit a character
+      time_t char_time();
+      /// @return Rate of the slave UART
+      uint32_t get_baud();
+
+      /// @brief Change the rate of the master
+      void master_configure(uint32_t baud);
+      /// @return Time for the master to transmit a character
+      time_t master_char_time();
+
+      /// @brief Slave side (the firmware UART)
+      void slave_on_receive(rx_handler_t handler);
+      void slave_send(const uint8_t *data, uint8_t size);
+
+      /// @brief Master side
+      void master_on_receive(std::function<void(uint8_t)> handler);
+      void master_send(const uint8_t *data, uint8_t size);
+
+      void report();
+   }
+
+   /// Piezzo, playing the notes of the tunes
+   namespace piezzo {
+      /// @return Number of notes sounded since power-up
+      size_t get_note_count();
+      /// @return Frequency of a note sounded, by its rank since power-up
+      uint16_t get_note(size_t index);
+      void report();
+   }
+}
@@ -2,17 +2,383 @@
  * Handles all modbus requests
  * From setting the leds, reading the switch or the active key, or sounding the buzzer
  */
-#include <piezzo.h>
+#include <avr/eeprom.h>
+
+#include <asx/reactor.hpp>
+
+#include <conf_console.h>
 
 #include "console.hpp"
+#include "diagnostics.hpp"
 #include "mux.hpp"
+#include "registers.hpp"
+#include "tune.hpp"
 
 using namespace asx;
+using namespace std::chrono;
 
 namespace console
 {
+    namespace {
+        constexpr uint8_t max_address = 247;
+        constexpr uint8_t custom_function = 101;
+        constexpr uint8_t wait_function = 102;
+
+        /// Unit of the timeout of the wait for change
+        constexpr auto wait_timeout_unit = 10ms;
+
+        /// Most registers in a reply of the input registers or of the FIFO, as declared
+        constexpr uint8_t max_reply_registers = 31;
+
+        /// Most key events in a FIFO reply, the count then 2 registers each
+        constexpr uint8_t max_key_events = (max_reply_registers - 1) / 2;
+
+        /// The input and holding registers declared in conf/datagram.conf.py
+        /// The input registers are declared for the 8 expanders a board may have, the ones beyond
+        ///  the board are refused when read.
+        static_assert(diagnostics::count <= 41);
+        static_assert(registers::count == 78);
+
+        /// Beeps of the buzzer register
+        constexpr uint8_t beep_tempo = 150;
+        constexpr auto beep_1 = tune::compile<"B4">();
+        constexpr auto beep_2 = tune::compile<"C4">();
+        constexpr auto beep_3 = tune::compile<"D4">();
+
+        /// Ready-made reply, CRC included: <address> <function> <data...> <crc>
+        template<uint8_t FUNCTION, uint8_t SIZE>
+        struct ReadyReply {
+            /// CRC of the head, which only changes with the address
+            static inline Crc head_crc;
+
+            uint8_t frame[SIZE + 4];
+
+            static void set_address(uint8_t address) {
+                head_crc.reset();
+                head_crc(address);
+                head_crc(FUNCTION);
+            }
+
+            void set(const uint8_t (&data)[SIZE]) {
+                auto crc = head_crc;
+
+                frame[0] = Datagram::get_address();
+                frame[1] = FUNCTION;
+
+                for (uint8_t i = 0; i < SIZE; ++i) {
+                    frame[2 + i] = data[i];
+                    crc(data[i]);
+                }
+
+                frame[SIZE + 2] = crc.get() & 0xff;
+                frame[SIZE + 3] = crc.get() >> 8;
+            }
+        };
+
+        /// Flags of the status register carried by the poll replies, which tell if the inputs are valid
+        constexpr uint8_t poll_flags = registers::initialising | registers::i2c_fault;
+
+        /// Reply to the custom frame: <address> 101 <sw> <key> <flags> <crc>
+        ReadyReply<custom_function, 3> custom_reply;
+
+        /// Reply to the wait for change: <address> 102 <sequence> <sw> <key> <flags> <crc>
+        ReadyReply<wait_function, 4> wait_reply;
+
+        /// Incremented on each change of the switches or active key
+        uint8_t change_sequence = 0;
+
+        /// A wait for change is pending its reply
+        bool waiting = false;
+
+        reactor::Handle react_on_wait_timeout;
+
+        uint8_t get_poll_flags() {
+            return registers::get(registers::status) & poll_flags;
+        }
+
+        void build_replies() {
+            uint8_t sw = mux::get_switch_status();
+            uint8_t key = mux::get_active_key_code();
+            uint8_t flags = get_poll_flags();
+
+            custom_reply.set({sw, key, flags});
+            wait_reply.set({change_sequence, sw, key, flags});
+        }
+
+        /// @brief Answer to a new address, from the next frame
+        void set_address(uint8_t address) {
+            Datagram::set_address(address);
+            decltype(custom_reply)::set_address(address);
+            decltype(wait_reply)::set_address(address);
+            registers::set(registers::slave_address, address);
+            build_replies();
+        }
+
+        /// @return The address kept in EEPROM, if any
+        uint8_t load_address() {
+            auto location = reinterpret_cast<const uint8_t *>(CONSOLE_ADDRESS_EEPROM);
+            uint8_t address = eeprom_read_byte(location);
+            uint8_t check = eeprom_read_byte(location + 1);
+
+            if ( address == 0 or address > max_address or check != uint8_t(~address) ) {
+                return CONSOLE_DEFAULT_ADDRESS;
+            }
+
+            return address;
+        }
+
+        /// Interval at which the EEPROM is checked until ready
+        constexpr auto eeprom_poll = 1ms;
+
+        /// Address to keep in EEPROM, and the bytes of it left to write
+        uint8_t stored_address;
+        uint8_t store_left = 0;
+
+        reactor::Handle react_on_store_address;
+
+        /// @brief Write the address then its complement, a byte each time the EEPROM is ready
+        /// Runs once the reply is out, and never waits for the EEPROM.
+        void on_store_address() {
+            auto location = reinterpret_cast<uint8_t *>(CONSOLE_ADDRESS_EEPROM);
+
+            if ( not eeprom_is_ready() ) {
+                react_on_store_address.delay(eeprom_poll);
+                return;
+            }
+
+            if ( store_left == 2 ) {
+                eeprom_update_byte(location, stored_address);
+            } else {
+                eeprom_update_byte(location + 1, ~stored_address);
+            }
+
+            if ( --store_left ) {
+                react_on_store_address.delay(eeprom_poll);
+            }
+        }
+
+        /// @brief Keep the address in EEPROM, after the reply
+        void store_address(uint8_t address) {
+            stored_address = address;
+            store_left = 2;
+            react_on_store_address.notify();
+        }
+
+        /// Line rates of the baud rate register
+        constexpr uint32_t baud_rates[] = {115200, 230400, 460800, 1000000};
+        static_assert(sizeof(baud_rates) / sizeof(baud_rates[0]) == registers::baud_count);
+        static_assert(UartConfig::baud == baud_rates[registers::baud_115200], "The console boots at the first rate");
+
+        /// A new line rate is acknowledged at the previous one, then tried until committed
+        enum class baud_state_t : uint8_t { steady, switching, trial };
+
+        baud_state_t baud_state = baud_state_t::steady;
+        uint8_t baud_code = registers::baud_115200;
+        uint8_t baud_fallback = registers::baud_115200;
+
+        reactor::Handle react_on_baud_switch;
+        reactor::Handle react_on_baud_revert;
+
+        void set_baud(uint8_t code) {
+            baud_code = code;
+            modbus_slave::set_baud(baud_rates[code]);
+            registers::set(registers::baud_rate, code);
+        }
+
+        void on_baud_switch() {
+            baud_state = baud_state_t::trial;
+            set_baud(baud_code);
+            registers::set_flags(registers::status, registers::baud_uncommitted, true);
+            react_on_baud_revert.delay(milliseconds{CONSOLE_BAUD_COMMIT_MS});
+        }
+
+        void on_baud_revert() {
+            baud_state = baud_state_t::steady;
+            set_baud(baud_fallback);
+            registers::set_flags(registers::status, registers::baud_uncommitted, false);
+        }
+
+        /// @brief Check a value for the baud rate register
+        /// While a new rate is switched to, none is accepted, then only the new rate, to commit it.
+        modbus::error_t check_baud_rate(uint16_t value) {
+            if ( value >= registers::baud_count or baud_state == baud_state_t::switching ) {
+                return modbus::error_t::illegal_data_value;
+            }
+
+            if ( baud_state == baud_state_t::trial and value != baud_code ) {
+                return modbus::error_t::illegal_data_value;
+            }
+
+            return modbus::error_t::ok;
+        }
+
+        /// @brief Write the baud rate register, once checked
+        /// A new rate is applied once the acknowledge is out. Writing it again at the new rate
+        ///  commits it, otherwise the previous rate is restored, so a master which cannot follow
+        ///  finds the console back.
+        void write_baud_rate(uint16_t value) {
+            if ( baud_state == baud_state_t::trial ) {
+                baud_state = baud_state_t::steady;
+                react_on_baud_revert.cancel();
+                registers::set_flags(registers::status, registers::baud_uncommitted, false);
+            } else if ( value != baud_code ) {
+                baud_state = baud_state_t::switching;
+                baud_fallback = baud_code;
+                baud_code = value;
+                react_on_baud_switch.delay(milliseconds{CONSOLE_BAUD_SWITCH_MS});
+            }
+        }
+
+        void send_wait_reply() {
+            waiting = false;
+            react_on_wait_timeout.cancel();
+            Uart::send(std::string_view{(const char *)wait_reply.frame, sizeof(wait_reply.frame)});
+        }
+
+        void on_wait_timeout() {
+            if ( waiting ) {
+                send_wait_reply();
+            }
+        }
+
+        /// @brief Check a value for a holding register, without applying it
+        modbus::error_t check_register(uint16_t addr, uint16_t value) {
+            if ( addr >= registers::effects and addr < registers::effects_end ) {
+                return mux::is_valid_effect(value) ? modbus::error_t::ok : modbus::error_t::illegal_data_value;
+            }
+
+            if ( addr >= registers::brightness and addr < registers::brightness_end ) {
+                return mux::is_valid_brightness(value) ? modbus::error_t::ok : modbus::error_t::illegal_data_value;
+            }
+
+            if ( addr >= registers::tune and addr < registers::tune_end ) {
+                return modbus::error_t::ok;
+            }
+
+            switch (addr) {
+            case registers::tune_tempo:
+                return value == 0 or value > 0xff ? modbus::error_t::illegal_data_value : modbus::error_t::ok;
+            case registers::slave_address:
+                // A broadcast would give all the consoles of the line the same address
+                if ( Datagram::is_broadcast() ) {
+                    return modbus::error_t::illegal_data_address;
+                }
+
+                return value == 0 or value > max_address ? modbus::error_t::illegal_data_value : modbus::error_t::ok;
+            case registers::baud_rate:
+                return check_baud_rate(value);
+            case registers::leds:
+                return modbus::error_t::ok;
+            case registers::buzzer:
+                return value > registers::buzzer_tune ? modbus::error_t::illegal_data_value : modbus::error_t::ok;
+            default:
+                // The reserved registers, the counters and the inputs are read only
+                return modbus::error_t::illegal_data_address;
+            }
+        }
+
+        /// @brief Apply the value of a holding register, once checked
+        void apply_register(uint16_t addr, uint16_t value) {
+            if ( addr >= registers::effects and addr < registers::effects_end ) {
+                mux::set_effect(addr - registers::effects, value);
+            } else if ( addr >= registers::brightness and addr < registers::brightness_end ) {
+                mux::set_brightness(addr - registers::brightness, value);
+            } else if ( addr >= registers::tune and addr < registers::tune_end ) {
+                registers::set(registers::index_t(addr), value);
+            } else {
+                switch (addr) {
+                case registers::tune_tempo:
+                    registers::set(registers::tune_tempo, value);
+                    break;
+                case registers::slave_address:
+                    store_address(value);
+                    set_address(value);
+                    break;
+                case registers::baud_rate:
+                    write_baud_rate(value);
+                    break;
+                case registers::leds:
+                    mux::set_leds(value);
+                    break;
+                case registers::buzzer:
+                    switch(value) {
+                        case registers::buzzer_silent: tune::stop(); break;
+                        case 1: tune::play(beep_tempo, beep_1); break;
+                        case 2: tune::play(beep_tempo, beep_2); break;
+                        case 3: tune::play(beep_tempo, beep_3); break;
+                        case registers::buzzer_tune:
+                            // Played in place, the image holds the notes as packed
+                            tune::play(
+                                registers::get(registers::tune_tempo),
+                                reinterpret_cast<const tune::Note *>(&registers::image[registers::tune * 2]),
+                                registers::tune_end - registers::tune);
+                            break;
+                    }
+                    break;
+                }
+            }
+        }
+
+        /// @brief Write a holding register, applying its value if valid
+        modbus::error_t write_register(uint16_t addr, uint16_t value) {
+            auto error = check_register(addr, value);
+
+            if ( error == modbus::error_t::ok ) {
+                apply_register(addr, value);
+            }
+
+            return error;
+        }
+
+        /// @brief Write consecutive registers from a request, or reply with the error
+        /// All the values are checked before any is applied, so an exception leaves the registers
+        ///  as they were.
+        /// @return true if all were written
+        bool write_registers(uint16_t from, uint16_t qty, uint8_t bytecount, const uint8_t *values, uint8_t size) {
+            if ( bytecount != qty * 2 or size != bytecount ) {
+                Datagram::reply_error(modbus::error_t::illegal_data_value);
+                return false;
+            }
+
+            if ( from >= registers::count or qty > registers::count - from ) {
+                Datagram::reply_error(modbus::error_t::illegal_data_address);
+                return false;
+            }
+
+            for (uint8_t i = 0; i < qty; ++i) {
+                auto error = check_register(from + i, values[2 * i] << 8 | values[2 * i + 1]);
+
+                if ( error != modbus::error_t::ok ) {
+                    Datagram::reply_error(error);
+                    return false;
+                }
+            }
+
+            for (uint8_t i = 0; i < qty; ++i) {
+                apply_register(from + i, values[2 * i] << 8 | values[2 * i + 1]);
+            }
+
+            return true;
+        }
+    }
+
+    void init() {
+        // Served at once, the key and switches are valid once the mux has read the inputs
+        registers::set_flags(registers::status, registers::initialising, true);
+        registers::set(registers::buzzer, registers::buzzer_read);
+        registers::set(registers::tune_tempo, beep_tempo);
+        set_address(load_address());
+        modbus_slave::init(UartConfig::baud);
+        react_on_wait_timeout = reactor::bind(on_wait_timeout);
+        react_on_baud_switch = reactor::bind(on_baud_switch);
+        react_on_baud_revert = reactor::bind(on_baud_revert);
+        react_on_store_address = reactor::bind(on_store_address);
+    }
+
     /// @brief  Read 4 bits for the switch
     void on_get_sw_status(uint8_t addr, uint8_t qty) {
+       static_assert(Datagram::fits(6));
+
        // Validate quantity against the available number of LEDs
        if (addr + qty > 4) {
            Datagram::reply_error(modbus::error_t::illegal_data_value);
@@ -23,23 +389,64 @@ namespace console
        Datagram::pack<uint8_t>((mux::get_switch_status() >> addr) & ((1 << qty) - 1));
     }
 
-    /// @brief  Get the currently pushed active key
-    void on_get_active_key() {
+    /// @brief  Get the currently pushed active key, then the diagnostics counters
+    void on_read_input_registers(uint16_t from, uint16_t qty) {
+        static_assert(Datagram::fits(5 + 2 * max_reply_registers));
+
+        if ( from + qty > diagnostics::count ) {
+            Datagram::reply_error(modbus::error_t::illegal_data_address);
+            return;
+        }
+
         Datagram::set_size(2);
-        Datagram::pack<uint8_t>(2);
-        Datagram::pack<uint16_t>(mux::get_active_key_code());
+        Datagram::pack<uint8_t>(qty * 2);
+
+        for (auto i = from; i < from + qty; ++i) {
+            Datagram::pack<uint16_t>(i == diagnostics::active_key ? mux::get_active_key_code() : diagnostics::counters[i]);
+        }
+    }
+
+    /// @brief Serial line diagnostics, on the counters
+    /// Format: 37 8 <sub-function=16> <data=16> <crc=16> <== 37 8 <sub-function=16> <data=16> <crc=16>
+    void on_diagnostics(uint16_t sub_function, uint16_t data) {
+        static_assert(Datagram::fits(8));
+
+        switch (sub_function) {
+        case 0x00: // Return the query data, the request is echoed
+            return;
+        case 0x0A:
+            diagnostics::clear();
+            return;
+        case 0x0B:
+            data = diagnostics::counters[diagnostics::frames];
+            break;
+        case 0x0C:
+            data = diagnostics::counters[diagnostics::frames_bad_crc];
+            break;
+        case 0x0D:
+            data = diagnostics::counters[diagnostics::exceptions];
+            break;
+        default:
+            Datagram::reply_error(modbus::error_t::illegal_function_code);
+            return;
+        }
+
+        Datagram::set_size(4);
+        Datagram::pack<uint16_t>(data);
     }
 
    void on_write_leds_8(uint8_t addr, uint8_t qty, uint8_t x, uint8_t data) {
       if (addr + qty > 12) {
          Datagram::reply_error(modbus::error_t::illegal_data_value);
-      } else {
-         for (uint8_t i=addr; i < addr + qty; ++i) {
-            mux::set_led(i, data & 1);
-            data >>= 9;
-         }
+         return;
+      }
+
+      for (uint8_t i=addr; i < addr + qty; ++i) {
+         mux::set_led(i, data & 1);
+         data >>= 1;
       }
 
+      // Reply with the start and quantity
       Datagram::set_size(6);
    }
 
@@ -57,18 +464,15 @@ namespace console
    }
 
    void on_read_leds(uint8_t addr, uint8_t qty) {
+       static_assert(Datagram::fits(7));
+
        // Validate quantity against the available number of LEDs
        if (addr + qty > 12) {
            Datagram::reply_error(modbus::error_t::illegal_data_value);
            return;
        }
 
-       uint16_t value = 0;
-
-       // Build the value by reading the LEDs
-       for (uint8_t i = 0; i < qty; ++i) {
-           value |= (mux::get_led(addr + i) ? 1 : 0) << i;
-       }
+       uint16_t value = (mux::get_leds() >> addr) & ((1U << qty) - 1);
 
        // Determine the size of the response
        uint8_t byte_count = (qty > 8) ? 2 : 1;
@@ -84,43 +488,125 @@ namespace console
 
     /// Custom package. Set the leds and return the push buttons and switches
     /// This is the most efficient transfer.
-    /// Format: 37 100 <leds=16> <crc=16> <== 37 100 <sw=8> <key=8> <crc=16>
-    /// Size: 6 + 6 (+2ms for the frame) = 20T < 4ms@115200
+    /// Format: 37 101 <leds=16> <crc=16> <== 37 101 <sw=8> <key=8> <flags=8> <crc=16>
+    /// The flags are the initialising (0x8) and I2C fault (0x10) bits of the status register.
+    /// Size: 6 + 7 = 13T, 1.2ms@115200 or 0.14ms@1Mbaud, plus the 1.75ms silence ending each frame
     /// Periodic send every 20ms
+    /// The reply is ready-made, so answering is a copy.
     /// @param leds 12-bits with LED to change
     void on_custom(uint16_t leds) {
+        waiting = false;
         mux::set_leds(leds);
-        Datagram::set_size(2);
-        Datagram::pack(mux::get_switch_status());
-        Datagram::pack(mux::get_active_key_code());
+        Datagram::reply_with(custom_reply.frame);
     }
 
+    /// Long poll. Set the leds, and only reply once the push buttons or switches change.
+    /// Format: 37 102 <leds=16> <seq=8> <timeout=8> <crc=16> <== 37 102 <seq=8> <sw=8> <key=8> <flags=8> <crc=16>
+    /// The reply is immediate if the change sequence differs from the one of the master,
+    ///  otherwise it is sent on the next change, or once timeout x 10ms have elapsed.
+    /// The master must not talk on the bus while waiting for the reply.
+    void on_wait_for_change(uint16_t leds, uint8_t sequence, uint8_t timeout) {
+        mux::set_leds(leds);
+
+        if ( sequence != change_sequence ) {
+            waiting = false;
+            Datagram::reply_with(wait_reply.frame);
+        } else {
+            waiting = true;
+            react_on_wait_timeout.delay(timeout * wait_timeout_unit);
+            Datagram::reply_error(modbus::error_t::ignore_frame);
+        }
+    }
 
+    void on_inputs_changed() {
+        auto sw = mux::get_switch_status();
+        auto key = mux::get_active_key_code();
+        auto flags = get_poll_flags();
+
+        if ( sw != custom_reply.frame[2] or key != custom_reply.frame[3] or flags != custom_reply.frame[4] ) {
+            ++change_sequence;
+            registers::set(registers::change_sequence, change_sequence);
+            build_replies();
+
+            if ( waiting ) {
+                send_wait_reply();
+            }
+        }
+    }
+
+
+   /// Drain the key events, oldest first. The master reads again if the reply is full.
+   /// Format: 37 24 <bytes=16> <registers=16> <seq=8> <code=8> <ms=16>... <crc=16>
+   /// The code has its MSB set when pressed, and the kind of gesture in bits 5-6 (see gestures.hpp).
+   void on_read_key_events(uint16_t) {
+      static_assert(Datagram::fits(8 + 4 * max_key_events));
+
+      uint8_t count = mux::get_key_event_count();
+
+      if ( count > max_key_events ) {
+         count = max_key_events;
+      }
+
+      Datagram::set_size(2);
+      Datagram::pack<uint16_t>(2 + count * 4);
+      Datagram::pack<uint16_t>(count * 2);
+
+      mux::KeyEvent event;
+
+      while ( count-- and mux::pop_key_event(event) ) {
+         Datagram::pack<uint8_t>(event.sequence);
+         Datagram::pack<uint8_t>(event.code);
+         Datagram::pack<uint16_t>(event.timestamp);
+      }
+
+      registers::set_flags(registers::status, registers::key_events_lost, false);
+   }
+
+   /// @brief Reply with a copy of the register image
    void on_read_holding(uint16_t addr, uint16_t qty) {
+      static_assert(Datagram::fits(5 + 2 * registers::count));
+
+      if ( addr >= registers::count or qty > registers::count - addr ) {
+         Datagram::reply_error(modbus::error_t::illegal_data_address);
+         return;
+      }
+
       Datagram::set_size(2);
       Datagram::pack<uint8_t>(qty * 2);
-      for (uint16_t i=addr; i<addr+qty; ++i) {
-         uint16_t value = 0;
-         if ( i == 10 ) {
-            value = 99;
-         }
-         Datagram::pack<uint16_t>(value);
+      Datagram::pack(&registers::image[addr * 2], qty * 2);
+   }
+
+   void on_write_holding(uint16_t addr, uint16_t value) {
+      auto error = write_register(addr, value);
+
+      if ( error != modbus::error_t::ok ) {
+         Datagram::reply_error(error);
       }
    }
 
-    void on_write_holding(uint16_t addr, uint16_t value) {
-      if ( addr == 10 ) {
-         switch(value) {
-            case 0: break;
-            case 1: piezzo_play(150, "B4"); break;
-            case 2: piezzo_play(150, "C4"); break;
-            case 3: piezzo_play(150, "D4"); break;
-            default:
-               Datagram::reply_error(modbus::error_t::illegal_data_value);
-               break;
-         }
-      } else {
-         Datagram::reply_error(modbus::error_t::illegal_data_value);
+   /// Write the LEDs and the buzzer, and read back the state in a single transaction
+   /// The registers are written, then read.
+   /// Format: 37 23 <read from=16> <read qty=16> <write from=16> <write qty=16> <bytes=8> <values...> <crc=16>
+   ///  <== 37 23 <bytes=8> <values...> <crc=16>
+   void on_read_write_registers(
+      uint16_t read_from, uint16_t read_qty, uint16_t write_from, uint16_t write_qty,
+      uint8_t bytecount, const uint8_t *values, uint8_t size)
+   {
+      if ( read_from >= registers::count or read_qty > registers::count - read_from ) {
+         Datagram::reply_error(modbus::error_t::illegal_data_address);
+         return;
       }
-    }
-}
\ No newline at end of file
+
+      if ( write_registers(write_from, write_qty, bytecount, values, size) ) {
+         on_read_holding(read_from, read_qty);
+      }
+   }
+
+   /// Write a block of registers, like the uploaded tune
+   /// Format: 37 16 <from=16> <qty=16> <bytes=8> <values...> <crc=16> <== 37 16 <from=16> <qty=16> <crc=16>
+   void on_write_registers(uint16_t from, uint16_t qty, uint8_t bytecount, const uint8_t *values, uint8_t size) {
+      if ( write_registers(from, qty, bytecount, values, size) ) {
+         Datagram::set_size(6);
+      }
+   }
+}
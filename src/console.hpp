@@ -2,6 +2,7 @@
 
 #include <asx/uart.hpp>
 #include "datagram.hpp"
+#include "rtu.hpp"
 
 namespace console {
     /** Define the Usart to use by the rs485 */
@@ -15,5 +16,12 @@ namespace console {
     >;
 
     using Uart = asx::uart::Uart<1, UartConfig>;    
-    using modbus_slave = asx::modbus::Slave<Datagram, Uart>;
+    using modbus_slave = rtu::Slave<Datagram, Uart>;
+
+    /// @brief Start the Modbus slave
+    void init();
+
+    /// @brief Refresh the ready-made reply to the custom poll frame
+    /// Called by the mux once new inputs are integrated, or an expander goes out of or back in service.
+    void on_inputs_changed();
 }
\ No newline at end of file
@@ -0,0 +1,66 @@
+#pragma once
+/**
+ * Table driven Modbus CRC16
+ * The table is computed at compile time. On the ATtiny3224 the flash is mapped in the data
+ *  space, so the const table stays in flash and is read with a regular load.
+ * Drop-in replacement for asx::modbus::Crc, at the cost of 512 bytes of flash.
+ */
+#include <stdint.h>
+#include <string_view>
+
+namespace console {
+   namespace crc_table {
+      constexpr uint16_t polynomial = 0xA001;
+
+      struct Table {
+         uint16_t value[256];
+
+         constexpr Table() : value{} {
+            for (uint16_t i = 0; i < 256; ++i) {
+               uint16_t crc = i;
+
+               for (uint8_t bit = 0; bit < 8; ++bit) {
+                  crc = (crc & 1) ? (crc >> 1) ^ polynomial : crc >> 1;
+               }
+
+               value[i] = crc;
+            }
+         }
+      };
+
+      inline constexpr Table table{};
+   }
+
+   class Crc {
+      uint16_t crc = 0xFFFF;
+
+   public:
+      constexpr void reset() noexcept {
+         crc = 0xFFFF;
+      }
+
+      /// @brief Add a character to the CRC
+      constexpr uint16_t operator()(const uint8_t c) noexcept {
+         crc = (crc >> 8) ^ crc_table::table.value[(crc ^ c) & 0xFF];
+         return crc;
+      }
+
+      constexpr uint16_t update(std::string_view view) noexcept {
+         for (auto c : view) {
+            (*this)(static_cast<uint8_t>(c));
+         }
+
+         return crc;
+      }
+
+      /// @return The current CRC, to be sent LSB first
+      constexpr uint16_t get() const noexcept {
+         return crc;
+      }
+
+      /// @return true if the data including its trailing CRC is valid
+      constexpr bool check() const noexcept {
+         return crc == 0;
+      }
+   };
+}
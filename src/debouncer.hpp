@@ -0,0 +1,100 @@
+#pragma once
+/**
+ * Vertical counter debouncer
+ * Each input bit owns a small counter, stored bit-sliced across the planes so that all the inputs
+ *  of a word are counted at once with a few logical operations.
+ * A counter runs while its input differs from the debounced state, and is cleared as soon as the
+ *  input agrees again. The debounced bit flips once the counter reaches the threshold of its
+ *  direction: PRESS consecutive samples to become 1, RELEASE consecutive samples to become 0.
+ * The cost is constant, whatever the number of changing inputs.
+ */
+#include <stdint.h>
+
+namespace console {
+   template<typename T, uint8_t PRESS, uint8_t RELEASE>
+   class Debouncer {
+      static_assert(PRESS > 0 and RELEASE > 0, "At least 1 sample is needed to change");
+
+      static constexpr uint8_t max_samples = PRESS > RELEASE ? PRESS : RELEASE;
+
+      /// Number of bits to count up to the largest threshold
+      static constexpr uint8_t bit_width(uint8_t value) {
+         uint8_t width = 0;
+
+         for (; value; value >>= 1) {
+            ++width;
+         }
+
+         return width;
+      }
+
+      static constexpr uint8_t depth = bit_width(max_samples);
+
+      T planes[depth] = {};
+      T state = 0;
+
+      /// @return The mask of the counters equal to a constant
+      constexpr T equals(uint8_t value) const {
+         T match = ~T{0};
+
+         for (uint8_t i = 0; i < depth; ++i) {
+            match &= (value & (1U << i)) ? planes[i] : ~planes[i];
+         }
+
+         return match;
+      }
+
+   public:
+      /// @brief Integrate a new sample of all the inputs
+      /// @return The debounced inputs
+      constexpr T sample(T raw) {
+         T delta = raw ^ state;
+         T carry = delta;
+
+         // Count up the changing inputs, clear the others
+         for (uint8_t i = 0; i < depth; ++i) {
+            T next = planes[i] ^ carry;
+            carry &= planes[i];
+            planes[i] = next & delta;
+         }
+
+         T flip = delta & ((state & equals(RELEASE)) | (~state & equals(PRESS)));
+
+         state ^= flip;
+
+         for (auto &plane : planes) {
+            plane &= ~flip;
+         }
+
+         return state;
+      }
+
+      /// @brief Take the inputs as they are, such as on the first read after power-up
+      /// @return The debounced inputs
+      constexpr T seed(T raw) {
+         for (auto &plane : planes) {
+            plane = 0;
+         }
+
+         state = raw;
+
+         return state;
+      }
+
+      /// @return The debounced inputs
+      constexpr T get() const {
+         return state;
+      }
+
+      /// @return true if no input is pending a change
+      constexpr bool stable() const {
+         T pending = 0;
+
+         for (auto plane : planes) {
+            pending |= plane;
+         }
+
+         return pending == 0;
+      }
+   };
+}
@@ -0,0 +1,80 @@
+#pragma once
+/**
+ * Runtime counters and latency histograms, served as Modbus input registers
+ * The counters are plain 16-bit words, updated where the events occur at a constant cost. They
+ *  wrap, and are cleared together with the diagnostics function (08), sub-function 0x0A.
+ * A histogram counts the samples in 8 bins, doubling from a base: [0, base), [base, 2 base),
+ *  up to [64 base, +inf). Its maximum is kept alongside.
+ * The times are measured with the steady clock, in us.
+ * The I2C errors and the recoveries are also counted for each expander of the board, so the
+ *  number of registers follows the board.
+ */
+#include <stdint.h>
+
+#include <conf_mux_board.hpp>
+
+namespace console {
+   namespace diagnostics {
+      /// Expanders with their own error and recovery counters
+      constexpr uint8_t nb_expanders = mux::Layout<board::Panel>::nb_expanders;
+
+      /// Input registers, the active key first
+      enum index_t : uint8_t {
+         active_key,          ///< Not a counter, served by the mux
+         frames,              ///< Frames received, including the ones for other nodes
+         frames_not_for_me,   ///< Frames for other nodes
+         frames_bad_crc,      ///< Frames with a bad CRC
+         exceptions,          ///< Exception replies
+         i2c_transfers,       ///< I2C transfers completed
+         i2c_errors,          ///< I2C transfers which failed
+         poll_jitter_max,     ///< Largest lateness of a timed poll of the expanders (us)
+         poll_jitter,         ///< Histogram of the lateness of the polls, from 64us
+         poll_jitter_end = poll_jitter + 8,
+         turnaround_max = poll_jitter_end, ///< Longest time from the T3.5 ending a request to the start of its reply (us)
+         turnaround,          ///< Histogram of the turnaround, from 16us
+         turnaround_end = turnaround + 8,
+         expander_errors = turnaround_end, ///< I2C failures of each expander
+         expander_errors_end = expander_errors + nb_expanders,
+         expander_recoveries = expander_errors_end, ///< Times each expander was put back in service
+         expander_recoveries_end = expander_recoveries + nb_expanders,
+         count = expander_recoveries_end
+      };
+
+      constexpr uint8_t histogram_bins = 8;
+      constexpr uint16_t poll_jitter_base = 64;
+      constexpr uint16_t turnaround_base = 16;
+
+      inline uint16_t counters[count];
+
+      inline void increment(index_t index) {
+         ++counters[index];
+      }
+
+      inline void add(index_t index, uint16_t count) {
+         counters[index] += count;
+      }
+
+      /// @brief Add a sample to a histogram, and to its maximum kept in the register before it
+      inline void record(index_t histogram, uint16_t base, uint32_t us) {
+         uint8_t bin = 0;
+
+         for (uint32_t limit = base; us >= limit and bin < histogram_bins - 1; limit <<= 1) {
+            ++bin;
+         }
+
+         ++counters[histogram + bin];
+
+         uint16_t clipped = us > 0xffff ? 0xffff : us;
+
+         if ( clipped > counters[histogram - 1] ) {
+            counters[histogram - 1] = clipped;
+         }
+      }
+
+      inline void clear() {
+         for (auto &counter : counters) {
+            counter = 0;
+         }
+      }
+   }
+}
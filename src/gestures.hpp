@@ -0,0 +1,172 @@
+#pragma once
+/**
+ * Key gestures, recognised from the debounced keys
+ * The keys resolve to a single active code: a key, in the upper half with the shift, or a chord
+ *  of keys held together, numbered after the shifted keys. A key of a chord is held back for
+ *  CHORD_MS, for the other keys of the chord to join. Once a code is active the other keys are
+ *  ignored, and none is active again until all the keys are released.
+ * Each change of the active code is emitted as a release and a press event. The gestures are
+ *  emitted as events of their own kind, with the code and the press flag:
+ *  - a long press once the code is held for LONG_MS,
+ *  - then a repeat every REPEAT_MS while it is still held,
+ *  - a double press when the code is pressed again within DOUBLE_MS of its release.
+ * A time of 0 disables its gesture. The times are in ms and wrap. The engine is updated on each
+ *  sample of the keys, and when next() falls due as the bus may be idle while a key is held.
+ */
+#include <stdint.h>
+
+namespace console {
+   template<uint8_t NB_KEYS, uint8_t NB_CHORDS, uint16_t LONG_MS, uint16_t REPEAT_MS, uint16_t DOUBLE_MS, uint16_t CHORD_MS>
+   class Gestures {
+      static_assert(2 * NB_KEYS + NB_CHORDS < 0x20, "A code is 5 bits, with the shift and the chords");
+      static_assert(LONG_MS < 0x8000 and REPEAT_MS < 0x8000 and DOUBLE_MS < 0x8000, "The times wrap at 65s");
+
+   public:
+      /// Flags of an event code
+      static constexpr uint8_t press = 0x80;        ///< Pressed, or a gesture while pressed
+      static constexpr uint8_t long_press = 0x20;
+      static constexpr uint8_t repeat = 0x40;
+      static constexpr uint8_t double_press = 0x60;
+      static constexpr uint8_t kind_msk = 0x60;     ///< Kind of event, 0 for a press or release
+
+      using emit_t = void (*)(uint8_t code);
+
+   private:
+      const uint16_t *chords;  ///< Keys of each chord
+      uint16_t chord_keys = 0; ///< Keys part of a chord, held back
+
+      uint16_t keys = 0;       ///< Keys as last sampled
+      bool shift = false;
+      uint16_t keys_since = 0; ///< Time the keys last changed
+
+      uint8_t active = 0;
+      bool clear = false;      ///< Waiting for all the keys to be released
+
+      uint16_t pressed_at = 0; ///< Time the active code was pressed
+      bool long_done = false;
+      uint16_t repeat_at = 0;
+
+      uint8_t released = 0;    ///< Last code released, and when
+      uint16_t released_at = 0;
+
+      static constexpr bool reached(uint16_t at, uint16_t now) {
+         return int16_t(now - at) >= 0;
+      }
+
+      /// @return The code is still held
+      bool held(uint8_t code) const {
+         if ( code > 2 * NB_KEYS ) {
+            uint16_t chord = chords[code - 2 * NB_KEYS - 1];
+            return (keys & chord) == chord;
+         }
+
+         return keys & (1U << ((code - 1) % NB_KEYS));
+      }
+
+      /// @return The code of the keys, 0 for none yet
+      uint8_t resolve(uint16_t now) const {
+         for (uint8_t i = 0; i < NB_CHORDS; ++i) {
+            if ( keys == chords[i] ) {
+               return 2 * NB_KEYS + 1 + i;
+            }
+         }
+
+         // Several keys which are not a chord, or a key of a chord waiting for the others
+         if ( (keys & (keys - 1)) != 0 or ((keys & chord_keys) and not reached(keys_since + CHORD_MS, now)) ) {
+            return 0;
+         }
+
+         return __builtin_ctz(keys) + (shift ? NB_KEYS : 0) + 1;
+      }
+
+   public:
+      /// @param chords Keys of each chord, a bit each
+      constexpr explicit Gestures(const uint16_t *chords) : chords{chords} {
+         for (uint8_t i = 0; i < NB_CHORDS; ++i) {
+            chord_keys |= chords[i];
+         }
+      }
+
+      /// @brief Resolve the keys at a time, and emit the events
+      void update(uint16_t sampled, bool shifted, uint16_t now, emit_t emit) {
+         uint8_t previous = active;
+
+         if ( sampled != keys ) {
+            keys = sampled;
+            keys_since = now;
+         }
+
+         shift = shifted;
+
+         if ( keys == 0 ) {
+            clear = false;
+            active = 0;
+         } else if ( clear ) {
+            // Do nothing
+         } else if ( active == 0 ) {
+            active = resolve(now);
+         } else if ( not held(active) ) {
+            clear = true;
+         }
+
+         if ( active != previous ) {
+            if ( previous ) {
+               emit(previous);
+               released = previous;
+               released_at = now;
+            }
+
+            if ( active ) {
+               emit(active | press);
+
+               if ( DOUBLE_MS and active == released and not reached(released_at + DOUBLE_MS + 1, now) ) {
+                  emit(active | double_press | press);
+               }
+
+               pressed_at = now;
+               long_done = false;
+            }
+         }
+
+         if ( active == 0 or clear ) {
+            return;
+         }
+
+         if ( LONG_MS and not long_done and reached(pressed_at + LONG_MS, now) ) {
+            emit(active | long_press | press);
+            long_done = true;
+            repeat_at = pressed_at + LONG_MS + REPEAT_MS;
+         } else if ( REPEAT_MS and long_done and reached(repeat_at, now) ) {
+            emit(active | repeat | press);
+            repeat_at += REPEAT_MS;
+         }
+      }
+
+      /// @brief Time to the next gesture falling due, for update to be called then
+      /// @return false if none is timed
+      bool next(uint16_t now, uint16_t &wait) const {
+         uint16_t at;
+
+         if ( active == 0 and not clear and (keys & chord_keys) and (keys & (keys - 1)) == 0 ) {
+            at = keys_since + CHORD_MS;
+         } else if ( active == 0 or clear ) {
+            return false;
+         } else if ( LONG_MS and not long_done ) {
+            at = pressed_at + LONG_MS;
+         } else if ( LONG_MS and REPEAT_MS ) {
+            at = repeat_at;
+         } else {
+            return false;
+         }
+
+         wait = reached(at, now) ? 0 : at - now;
+
+         return true;
+      }
+
+      /// @return The active code, 0 if none
+      uint8_t get() const {
+         return active;
+      }
+   };
+}
@@ -0,0 +1,64 @@
+/**
+ * Clearing of the I2C bus
+ * The TWI is disabled so its pins (I2C_SCL_bm and I2C_SDA_bm of I2C_VPORT) go back to the port.
+ * The lines are driven as open drain: pulled low as outputs with a low level, released as
+ *  inputs, the bus pull-ups taking them high.
+ * SCL is clocked at 100kHz, whatever the frequency of the master, as any slave keeps up with it.
+ *  A slave stretching the clock is not waited for.
+ */
+#include <avr/io.h>
+#include <util/delay.h>
+
+#include <asx/i2c_master.hpp>
+#include <conf_board.h>
+
+#include "i2c_bus.hpp"
+
+namespace console {
+   namespace i2c_bus {
+      namespace {
+         /// A slave shifts out at most the 8 bits of its byte, then the acknowledge
+         constexpr uint8_t max_clocks = 9;
+
+         void pull(uint8_t line) {
+            I2C_VPORT.DIR |= line;
+         }
+
+         void release(uint8_t line) {
+            I2C_VPORT.DIR &= ~line;
+         }
+
+         bool released(uint8_t line) {
+            return I2C_VPORT.IN & line;
+         }
+
+         void half_period() {
+            _delay_us(5);
+         }
+      }
+
+      void clear(uint32_t frequency) {
+         TWI0.MCTRLA &= ~TWI_ENABLE_bm;
+         release(I2C_SCL_bm | I2C_SDA_bm);
+         I2C_VPORT.OUT &= ~(I2C_SCL_bm | I2C_SDA_bm);
+
+         for (uint8_t i = 0; i < max_clocks and not released(I2C_SDA_bm); ++i) {
+            pull(I2C_SCL_bm);
+            half_period();
+            release(I2C_SCL_bm);
+            half_period();
+         }
+
+         // Stop: SDA rises while SCL is high
+         pull(I2C_SCL_bm);
+         pull(I2C_SDA_bm);
+         half_period();
+         release(I2C_SCL_bm);
+         half_period();
+         release(I2C_SDA_bm);
+         half_period();
+
+         asx::i2c::Master::init(frequency);
+      }
+   }
+}
@@ -0,0 +1,16 @@
+#pragma once
+/**
+ * Clearing of the I2C bus
+ * A slave reset or disturbed in the middle of a read may hold SDA low, waiting for clocks to
+ *  shift out the rest of its byte. The master cannot start a transfer until it lets go.
+ */
+#include <stdint.h>
+
+namespace console {
+   namespace i2c_bus {
+      /// @brief Clock SCL until a slave holding SDA low lets go, send a stop, then initialise the
+      ///  master again at a frequency
+      /// Busy waits for up to 9 clocks at 100kHz. Must not be called while a transfer is in progress.
+      void clear(uint32_t frequency);
+   }
+}
@@ -5,25 +5,24 @@
 
 #include <asx/reactor.hpp>
 
-#include <piezzo.h>
-
 #include "console.hpp"
 #include "mux.hpp"
+#include "tune.hpp"
 
 
-/** Arcade tune */
-constexpr auto arcade_tune = "C,3 R C E G E G E D R D F A2~A3 B G E B G E B G E C' R B, C'~C1";
+/** Arcade tune, compiled to a note table in flash */
+constexpr auto arcade_tune = console::tune::compile<"C,3 R C E G E G E D R D F A2~A3 B G E B G E B G E C' R B, C'~C1">();
 
 int main()
 {
-   console::modbus_slave::init();
+   console::init();
    console::mux::init();
-   piezzo_init();
+   console::tune::init();
    debug_init(INFO);
 
 #ifdef NDEBUG
-   // Play some arcade tune from memory
-   piezzo_play(190, arcade_tune);
+   // Play some arcade tune from memory, once the inputs are read not to delay the first valid reply
+   console::mux::when_ready([] { console::tune::play(190, arcade_tune); });
 #endif
 
    // Run the reactor/scheduler
@@ -1,15 +1,52 @@
 /**
  * Handles the pin multiplexing
+ * The expanders and the role of their pins come from the board description (conf_mux_board.hpp).
+ * The transfers of a cycle are sequenced, each started from the completion of the previous one,
+ *  and the sequence completes once (see sequence.hpp). More expanders only add transfers to it.
  * The bus is sampled every 2ms where the LEDs are updated and the keys sampled.
- * The key are consolidated using a 3 cycle integrator, then consolidated into a single key.
+ * With MUX_USE_INT, the inputs are rather read when the expanders assert their /INT line, then
+ *  sampled at a fast rate until the keys are stable. The bus is left idle otherwise.
+ * The LEDs of an expander are only written if they changed, or on the periodic refresh.
+ * The inputs of all the expanders are read at the end of the sequence, debounced together by a
+ *  vertical counter, then consolidated into a single key or chord by the gesture engine.
+ * Each change of the active key is queued as a timestamped press or release event, and so are
+ *  the long presses, repeats and double presses. They are timed here, at the sampling, and on
+ *  their own timer while the bus is idle.
+ * The LEDs, inputs and counters are kept up to date in the register image.
+ * An LED can run an effect (blink, flash, pattern) rather than follow the LED word. The effects
+ *  are evaluated on their own tick and only cost a write when an LED toggles.
+ * The LEDs are dimmed by bit angle modulation: each LED is lit during the slots matching the bits
+ *  of its brightness. The slots are timed independently of the key sampling, and an expander is
+ *  only rewritten when its output differs from one slot to the next. The slots stop when no lit
+ *  LED is dimmed, so the bus stays idle at full brightness.
+ * The I2C transfers and the lateness of the timed polls are accounted in the diagnostics.
+ * An I2C failure takes the expander of the failing transfer out of service. The bus is cleared,
+ *  in case a slave holds SDA low (see i2c_bus.hpp), then only this expander is initialised
+ *  again. If it does not answer, the cycles resume without it and it is tried again every
+ *  MUX_RECOVERY_RETRY_MS. Its inputs hold their last state meanwhile, and the status shows the
+ *  fault.
  */
+#include <asx/chrono.hpp>
 #include <asx/pca9555.hpp>
 #include <asx/ioport.hpp>
 
+#include <array>
+#include <utility>
+
 #include <boost/sml.hpp>
 
-#include <alert.h>
+#include <conf_board.h>
+#include <conf_mux.h>
+#include <conf_mux_board.hpp>
+
+#include "sequence.hpp"
+#include "console.hpp"
+#include "debouncer.hpp"
+#include "diagnostics.hpp"
+#include "gestures.hpp"
+#include "i2c_bus.hpp"
 #include "mux.hpp"
+#include "registers.hpp"
 
 using namespace asx;
 using namespace asx::i2c;
@@ -20,158 +57,702 @@ namespace console {
    namespace mux {
       struct start {};
       struct i2c_ready {};
+      struct i2c_error {};
       struct polling {};
 
-      static constexpr auto leds_per_side = uint8_t{6};
-      static constexpr auto io_msk = uint8_t{0b00111111};
-      static constexpr auto shift_msk = uint8_t{1U << 5};
-      static constexpr auto door_msk = uint8_t{1U << 4};
-      static constexpr auto pol_right_msk = uint8_t{0b1111}; // Flip the switch
+      using layout = Layout<board::Panel>;
+
+      static constexpr auto use_int = bool{MUX_USE_INT};
+      static constexpr auto poll_period = 2ms;
+      static constexpr auto sample_period = microseconds{MUX_INT_SAMPLE_US};
+      static constexpr auto led_refresh_period = milliseconds{MUX_LED_REFRESH_MS};
+      static constexpr auto effect_tick = milliseconds{MUX_EFFECT_TICK_MS};
+      static constexpr auto dim_unit = microseconds{MUX_DIM_UNIT_US};
+      static constexpr auto recovery_retry = milliseconds{MUX_RECOVERY_RETRY_MS};
+      static constexpr auto i2c_frequency = 400_KHz;
+      static constexpr auto nb_leds = layout::nb_leds;
+      static constexpr auto nb_expanders = layout::nb_expanders;
+      static constexpr auto dim_slots = uint8_t{4};
+      static constexpr auto full_brightness = uint8_t{(1U << dim_slots) - 1};
+
+      static constexpr auto all_expanders = uint8_t((1U << nb_expanders) - 1);
+
+      static_assert(nb_leds <= registers::effects_end - registers::effects, "An effect and a brightness register per LED");
+
+      /// @brief LED word as set by the master, before the effects
+      uint16_t led_word = layout::all_leds;
+
+      /// @brief Holds the current value of the LEDs of each expander
+      uint8_t frame_buffer[nb_expanders];
+
+      /// @brief LEDs running an effect, and their current state
+      uint16_t effect_mask = 0;
+      uint16_t effect_on = 0;
+
+      /// @brief Ticks into the period of the blinking or patterned LEDs, wrapping at their period
+      /// Counted from the write of the effect, the LEDs written together run in phase.
+      uint16_t effect_phase[nb_leds];
+
+      /// @brief Ticks left of the flashing LEDs
+      uint16_t flash_left[nb_leds];
+
+      /// @brief LEDs lit in each bit angle slot, from their brightness
+      uint16_t slot_masks[dim_slots] = {layout::all_leds, layout::all_leds, layout::all_leds, layout::all_leds};
+      uint8_t dim_slot = 0;
+
+      /// @brief Set while some LEDs are dimmed, and the slots are running
+      bool dimming = false;
+
+      /// @brief Expanders with LEDs to write, a bit each
+      uint8_t dirty = 0;
+
+      /// @brief Expanders out of service after an I2C failure, skipped by the cycles
+      uint8_t faulty = 0;
+
+      /// @brief Expanders left to initialise again in the recovery in progress
+      uint8_t recovering = 0;
+
+      /// @brief The faulty expanders are due for another attempt
+      bool retry_due = false;
+
+      /// @brief Inputs to be sampled until stable. Always set when polling.
+      bool sampling = true;
+
+      /// @brief Inputs to be read in the current cycle, as the poll or the /INT line requested
+      bool read_due = false;
+
+      /// @brief Time the poll timer is due, to measure its lateness
+      chrono::steady_clock::time_point poll_due;
+
+      /// @brief Inputs of all the expanders, the first one in the low byte
+      Debouncer<layout::inputs_t, MUX_PRESS_SAMPLES, MUX_RELEASE_SAMPLES> inputs;
+
+      /// @brief Transfers of the sequence in progress: the init, or the writes and reads of a cycle
+      sequence::Transfer transfers[4 * nb_expanders];
+      uint8_t nb_transfers = 0;
+
+      /// @brief Expander of each transfer, to know which one failed
+      uint8_t owners[4 * nb_expanders];
+
+      /// @brief Directions and polarities of the ports, sent by the init sequence
+      uint8_t port_config[2][nb_expanders];
+
+      /// @brief The sequence in progress reads the inputs
+      bool cycle_reads = false;
+
+      /// @brief Called once the inputs are first read
+      void (*ready_action)() = nullptr;
 
-      /// @brief Holds the current value for the LEDs
-      uint8_t frame_buffer[] = {io_msk, io_msk};
+      /// @brief Active key (1 to 2 x nb_keys, the upper half with shift, then the chords) and gestures
+      Gestures<layout::nb_keys, layout::nb_chords, MUX_LONG_PRESS_MS, MUX_REPEAT_MS, MUX_DOUBLE_PRESS_MS, MUX_CHORD_MS>
+         gestures{layout::chords.data()};
 
-      struct KeyIntegrator {
-         uint8_t previous[3];
-         uint8_t current;
-      } integrator[2] = {0};
+      /// @brief Key events not read yet, oldest first
+      KeyEvent key_events[MUX_KEY_EVENTS];
+      uint8_t key_events_first = 0;
+      uint8_t key_events_count = 0;
+      uint8_t key_events_sequence = 0;
 
-      /// @brief Actual key being active (with filter and shift)
-      uint8_t active_key = 0; // 1 to 13 (1-6 / 7 / 8-14)
-      bool clear_nkeys = false;
+      template<size_t... I>
+      constexpr auto make_expanders(std::index_sequence<I...>) {
+         return std::array<PCA9555, nb_expanders>{PCA9555(layout::expanders[I].address)...};
+      }
 
-      auto iomux_left = PCA9555(0);
-      auto iomux_right = PCA9555(1);
+      auto iomux = make_expanders(std::make_index_sequence<nb_expanders>{});
+      auto int_pin = ioport::Pin(MUX_INT_PIN);
 
       // Handlers
       reactor::Handle react_on_poll;
+      reactor::Handle react_on_int;
+      reactor::Handle react_on_refresh;
+      reactor::Handle react_on_effects;
+      reactor::Handle react_on_flush;
+      reactor::Handle react_on_dim;
+      reactor::Handle react_on_retry;
+      reactor::Handle react_on_gesture;
       void on_i2c_ready(status_code_t code);
+      void on_effect_tick();
+      void on_dim_slot();
+
+      void start_polling() {
+         react_on_refresh.repeat(led_refresh_period);
+         poll_due = chrono::steady_clock::now();
+
+         if constexpr ( use_int ) {
+            react_on_poll.notify();
+         } else {
+            poll_due += poll_period;
+            react_on_poll.repeat(poll_period);
+         }
+      }
+
+      /// @return There are LEDs to write or inputs to read on the expanders in service
+      bool pending() {
+         return (dirty & ~faulty) != 0 or (read_due and faulty != all_expanders);
+      }
+
+      /// @return The faulty expanders are due for another attempt
+      bool retry() {
+         return retry_due and faulty != 0;
+      }
+
+      /// @brief Carry on until the LEDs are written and the due inputs read, and when interrupt
+      ///  driven until the keys are stable
+      void on_cycle_end() {
+         if ( pending() or retry() ) {
+            react_on_flush.notify();
+         } else if ( use_int and sampling ) {
+            poll_due = chrono::steady_clock::now() + sample_period;
+            react_on_poll.delay(sample_period);
+         }
+      }
+
+      void run_sequence() {
+         sequence::run(transfers, nb_transfers, on_i2c_ready);
+      }
+
+      void add_transfer(uint8_t e, sequence::Transfer::op_t op, uint8_t port, const uint8_t *value = nullptr) {
+         owners[nb_transfers] = e;
+         transfers[nb_transfers++] = sequence::Transfer{op, port, e, value};
+      }
+
+      /// @brief Write the output values, then the directions, then the polarities of all the expanders,
+      ///  and read the inputs for the key and switches to be valid at once
+      void init_sequence() {
+         nb_transfers = 0;
+
+         for (uint8_t e = 0; e < nb_expanders; ++e) {
+            port_config[0][e] = ~layout::ports.outputs[e];
+            port_config[1][e] = layout::ports.inverted[e];
+            add_transfer(e, sequence::Transfer::set_value, 0, &frame_buffer[e]);
+         }
+
+         for (uint8_t e = 0; e < nb_expanders; ++e) {
+            add_transfer(e, sequence::Transfer::set_dir, 0, &port_config[0][e]);
+         }
+
+         for (uint8_t e = 0; e < nb_expanders; ++e) {
+            add_transfer(e, sequence::Transfer::set_pol, 1, &port_config[1][e]);
+         }
+
+         for (uint8_t e = 0; e < nb_expanders; ++e) {
+            add_transfer(e, sequence::Transfer::read, 1);
+         }
+
+         cycle_reads = true;
+         run_sequence();
+      }
 
-      struct InitPCA {
+      /// @brief Write the LEDs of the expanders which changed, then read all the inputs if due
+      /// The expanders out of service are skipped, their LEDs are written as they are recovered.
+      void cycle_sequence() {
+         nb_transfers = 0;
+
+         for (uint8_t e = 0; e < nb_expanders; ++e) {
+            if ( faulty & (1U << e) ) {
+               continue;
+            }
+
+            if ( dirty & (1U << e) ) {
+               registers::increment(registers::led_writes);
+               add_transfer(e, sequence::Transfer::set_value, 0, &frame_buffer[e]);
+            }
+         }
+
+         dirty = 0;
+
+         cycle_reads = read_due and faulty != all_expanders;
+         read_due = read_due and not cycle_reads;
+
+         if ( cycle_reads ) {
+            for (uint8_t e = 0; e < nb_expanders; ++e) {
+               if ( not (faulty & (1U << e)) ) {
+                  add_transfer(e, sequence::Transfer::read, 1);
+               }
+            }
+         }
+
+         run_sequence();
+      }
+
+      void set_faulty(uint8_t expanders) {
+         faulty = expanders;
+         registers::set_flags(registers::status, registers::i2c_fault, faulty != 0);
+
+         // The poll replies carry the flag
+         on_inputs_changed();
+      }
+
+      /// @brief Write the outputs, then the direction and polarity of the next expander to recover
+      void recovery_sequence() {
+         uint8_t e = __builtin_ctz(recovering);
+
+         recovering &= recovering - 1;
+         nb_transfers = 0;
+         add_transfer(e, sequence::Transfer::set_value, 0, &frame_buffer[e]);
+         add_transfer(e, sequence::Transfer::set_dir, 0, &port_config[0][e]);
+         add_transfer(e, sequence::Transfer::set_pol, 1, &port_config[1][e]);
+
+         cycle_reads = false;
+         run_sequence();
+      }
+
+      /// @brief Clear the bus, then initialise the faulty expanders again one at a time
+      /// The LEDs are all written again after, as the failure may have cut the writes short.
+      void start_recovery() {
+         i2c_bus::clear(i2c_frequency);
+         dirty = all_expanders;
+         retry_due = false;
+         recovering = faulty;
+         recovery_sequence();
+      }
+
+      /// @brief The init did not complete: poll, and initialise all the expanders again
+      void on_init_error() {
+         set_faulty(all_expanders);
+         start_polling();
+         start_recovery();
+      }
+
+      /// @brief Resume the cycles, reading the inputs of the recovered expanders at once
+      void end_recovery() {
+         if ( faulty ) {
+            react_on_retry.delay(recovery_retry);
+         } else {
+            react_on_retry.cancel();
+         }
+
+         sampling = read_due = true;
+         on_cycle_end();
+      }
+
+      struct Sequencer {
          auto operator()() {
+            auto left = [] { return recovering != 0; };
 
             return make_transition_table(
-               * "idle"_s          + event<start>     / [] {iomux_left.set_value<0>(io_msk, on_i2c_ready); }          = "init1"_s
-               , "init1"_s         + event<i2c_ready> / [] {iomux_right.set_value<0>(io_msk, on_i2c_ready); }         = "init2"_s
-               , "init2"_s         + event<i2c_ready> / [] {iomux_left.set_dir<0>(~io_msk, on_i2c_ready); }           = "init3"_s
-               , "init3"_s         + event<i2c_ready> / [] {iomux_right.set_dir<0>(~io_msk, on_i2c_ready); }          = "init4"_s
-               , "init4"_s         + event<i2c_ready> / [] {iomux_left.set_pol<1>(0, on_i2c_ready); }                 = "init5"_s
-               , "init5"_s         + event<i2c_ready> / [] {iomux_right.set_pol<1>(pol_right_msk, on_i2c_ready);
-                                                            react_on_poll.repeat(2ms); }                              = "wait_for_poll"_s
-               , "wait_for_poll"_s + event<polling>   / [] {iomux_left.set_value<0>(frame_buffer[0], on_i2c_ready); } = "set_left"_s
-               , "set_left"_s      + event<i2c_ready> / [] {iomux_right.set_value<0>(frame_buffer[1], on_i2c_ready); }= "set_right"_s
-               , "set_right"_s     + event<i2c_ready> / [] {iomux_left.read<1>(on_i2c_ready); }                       = "get_left"_s
-               , "get_left"_s      + event<i2c_ready> / [] {iomux_right.read<1>(on_i2c_ready); }                      = "get_right"_s
-               , "get_right"_s     + event<i2c_ready>                                                                 = "wait_for_poll"_s
+               * "idle"_s          + event<start>                 / init_sequence     = "init"_s
+               , "init"_s          + event<i2c_ready>             / start_polling  = "wait_for_poll"_s
+               , "init"_s          + event<i2c_error>             / on_init_error  = "recover"_s
+               , "wait_for_poll"_s + event<polling>   [ retry ]   / start_recovery = "recover"_s
+               , "wait_for_poll"_s + event<polling>   [ pending ] / cycle_sequence    = "cycle"_s
+               , "cycle"_s         + event<i2c_ready>             / on_cycle_end   = "wait_for_poll"_s
+               , "cycle"_s         + event<i2c_error>             / start_recovery = "recover"_s
+               , "recover"_s       + event<i2c_ready> [ left ]    / recovery_sequence = "recover"_s
+               , "recover"_s       + event<i2c_error> [ left ]    / recovery_sequence = "recover"_s
+               , "recover"_s       + event<i2c_ready>             / end_recovery   = "wait_for_poll"_s
+               , "recover"_s       + event<i2c_error>             / end_recovery   = "wait_for_poll"_s
             );
          }
       };
 
-      //
-      i2c::Master::chain()
+      sm<Sequencer> i2c_sequencer;
 
-      sm<InitPCA> i2c_sequencer;
+      void push_key_event(uint8_t code) {
+         // Make room by dropping the oldest, the sequence shows the gap
+         if ( key_events_count == MUX_KEY_EVENTS ) {
+            key_events_first = (key_events_first + 1) % MUX_KEY_EVENTS;
+            --key_events_count;
+            registers::set_flags(registers::status, registers::key_events_lost, true);
+         }
+
+         auto ms = duration_cast<milliseconds>(chrono::steady_clock::now().time_since_epoch());
+         auto &event = key_events[(key_events_first + key_events_count++) % MUX_KEY_EVENTS];
 
-      void integrate_keys(uint8_t side, uint8_t current) {
-         KeyIntegrator &i = integrator[side];
+         event.sequence = key_events_sequence++;
+         event.code = code;
+         event.timestamp = static_cast<uint16_t>(ms.count());
 
-         i.previous[0] = i.previous[1]; i.previous[1] = i.previous[2]; i.previous[2] = current;
+         registers::set_flags(registers::status, registers::key_events_pending, true);
+      }
 
-         uint8_t debounced_on = (i.previous[0] | i.previous[1] | i.previous[2]);
-         uint8_t debounced_off = (i.previous[0] & i.previous[1] & i.previous[2]);
+      /// @brief Resolve the active key and the gestures from the debounced keys, and time the next gesture
+      void update_keys(layout::inputs_t debounced) {
+         auto now = static_cast<uint16_t>(duration_cast<milliseconds>(chrono::steady_clock::now().time_since_epoch()).count());
+         uint16_t wait;
 
-         i.current = (i.current & debounced_on) | debounced_off;
+         gestures.update(layout::keys(debounced), layout::shift(debounced), now, push_key_event);
+         registers::set(registers::active_key, gestures.get());
+
+         if ( gestures.next(now, wait) ) {
+            react_on_gesture.delay(milliseconds{wait});
+         } else {
+            react_on_gesture.cancel();
+         }
+      }
+
+      /// @brief A gesture falls due while the keys are unchanged
+      auto on_gesture() {
+         update_keys(inputs.get());
+         on_inputs_changed();
+      }
+
+      /// @brief The inputs are read for the first time, the replies carry valid keys and switches
+      void on_ready() {
+         auto us = duration_cast<microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+
+         registers::set(registers::ready_time, us < 0xFFFF ? us : 0xFFFF);
+         registers::set_flags(registers::status, registers::initialising, false);
+
+         if ( ready_action ) {
+            ready_action();
+         }
       }
 
       void on_i2c_ready(status_code_t code) {
-         alert_and_stop_if(code != status_code_t::STATUS_OK);
-
-         // If reading - integrate the keys
-         if ( i2c_sequencer.is("get_left"_s) ) {
-            integrate_keys(0, iomux_left.get_value<uint8_t>() & io_msk);
-         } else if ( i2c_sequencer.is("get_right"_s) ) {
-            integrate_keys(1, iomux_right.get_value<uint8_t>() & io_msk);
-
-            // Regroup the keys on 1 bytes 6 left + door + shift
-            bool shift = integrator[1].current & shift_msk;
-            bool door = integrator[1].current & door_msk;
-
-            // Create a view of all the push buttons (not accounting for the shift key)
-            uint8_t all_keys = integrator[0].current | (door?0b1000000:0);
-
-            // Calculate active keys - factoring the shift key
-            if ( all_keys != 0 ) {
-               if ( clear_nkeys ) {
-                  // Do nothing
-               } else if ( active_key == 0 ) {
-                  // Make sure only 1 bits set
-                  if ( (all_keys & (all_keys - 1)) == 0 ) {
-                     active_key = __builtin_ctzl(all_keys) + (shift?7:0) + 1;
-                  }
-               } else {
-                  // The key remains valid if it is pushed (ignore the shift)
-                  uint8_t key_bit = ( active_key < 6 ) ? active_key - 1 : active_key - 7;
+         if ( code == status_code_t::STATUS_OK ) {
+            diagnostics::add(diagnostics::i2c_transfers, nb_transfers);
 
-                  if ( not (all_keys & key_bit) ) {  // No longer pressed
-                     clear_nkeys = true;
-                  }
-               }
-            } else {
-               clear_nkeys = false;
-               active_key = 0;
+            // All the transfers of a recovery are for the same expander
+            if ( i2c_sequencer.is("recover"_s) ) {
+               diagnostics::increment(diagnostics::index_t(diagnostics::expander_recoveries + owners[0]));
+               set_faulty(faulty & ~(1U << owners[0]));
             }
+         } else {
+            uint8_t e = owners[sequence::completed()];
+
+            diagnostics::increment(diagnostics::i2c_errors);
+            diagnostics::increment(diagnostics::index_t(diagnostics::expander_errors + e));
+            set_faulty(faulty | (1U << e));
+            cycle_reads = false;
          }
 
-         i2c_sequencer.process_event(i2c_ready{});
+         // The first read is taken as is, there is no previous state to debounce from. It is the
+         //  read of the expanders which answered: the ones out of service read as released until
+         //  recovered, and show in the status as an I2C fault.
+         bool first = registers::get(registers::status) & registers::initialising;
+
+         // If reading - debounce the keys of all the expanders together
+         if ( cycle_reads ) {
+            layout::inputs_t raw_inputs = 0;
+
+            cycle_reads = false;
+
+            // The expanders out of service hold their last state
+            for (uint8_t e = 0; e < nb_expanders; ++e) {
+               uint8_t value = faulty & (1U << e) ? uint8_t(inputs.get() >> (8 * e)) : iomux[e].get_value<uint8_t>();
+               raw_inputs |= layout::inputs_t(value) << (8 * e);
+            }
+
+            raw_inputs &= layout::inputs_mask;
+
+            auto debounced = first ? inputs.seed(raw_inputs) : inputs.sample(raw_inputs);
+
+            update_keys(debounced);
+            registers::set(registers::switches, layout::switches(debounced));
+
+            if ( first ) {
+               on_ready();
+            }
+
+            // Keep the reply to the poll frame ready
+            on_inputs_changed();
+
+            // Keep sampling while bouncing, or if another change occurred since the reads
+            if constexpr ( use_int ) {
+               sampling = not inputs.stable() or not int_pin.get();
+            }
+         }
+
+         if ( code == status_code_t::STATUS_OK ) {
+            i2c_sequencer.process_event(i2c_ready{});
+         } else {
+            i2c_sequencer.process_event(i2c_error{});
+         }
+      }
+
+      void poll_inputs() {
+         // Served by the next cycle if a sequence is in progress
+         read_due = sampling;
+         i2c_sequencer.process_event(polling{});
       }
 
+      /// @brief The poll timer is due
       auto on_poll_input() {
+         auto late = duration_cast<microseconds>(chrono::steady_clock::now() - poll_due);
+         diagnostics::record(diagnostics::poll_jitter, diagnostics::poll_jitter_base, late.count() > 0 ? late.count() : 0);
+
+         if constexpr ( not use_int ) {
+            poll_due += poll_period;
+         }
+
+         poll_inputs();
+      }
+
+      /// @brief Write the changed LEDs without reading the inputs, between the polls
+      auto on_flush() {
          i2c_sequencer.process_event(polling{});
       }
 
+      /// @brief An input changed. If a cycle is in progress, it carries on sampling.
+      auto on_int() {
+         sampling = true;
+         poll_inputs();
+      }
+
+      /// @brief Another attempt at the expanders out of service, once the cycle in progress ends
+      auto on_retry() {
+         retry_due = true;
+
+         if ( i2c_sequencer.is("wait_for_poll"_s) ) {
+            react_on_flush.notify();
+         }
+      }
+
+      /// @brief Rewrite all the LEDs from time to time, should an expander have been disturbed
+      auto on_refresh() {
+         dirty = all_expanders;
+         on_cycle_end();
+      }
+
       void init() {
          react_on_poll = reactor::bind(on_poll_input);
+         react_on_refresh = reactor::bind(on_refresh);
+         react_on_effects = reactor::bind(on_effect_tick);
+         react_on_flush = reactor::bind(on_flush);
+         react_on_dim = reactor::bind(on_dim_slot);
+         react_on_retry = reactor::bind(on_retry);
+         react_on_gesture = reactor::bind(on_gesture);
+
+         if constexpr ( use_int ) {
+            react_on_int = reactor::bind(on_int);
+            int_pin.init(ioport::dir_t::in, ioport::pullup_t::up);
+            int_pin.react_on_falling(react_on_int);
+         }
+
+         registers::set(registers::leds, get_leds());
+
+         // Written as the expanders are initialised
+         for (uint8_t e = 0; e < nb_expanders; ++e) {
+            frame_buffer[e] = layout::ports.leds_to[e](led_word);
+         }
 
-         i2c::Master::init(400_KHz);
+         for (uint8_t i = 0; i < nb_leds; ++i) {
+            registers::set(registers::index_t(registers::brightness + i), full_brightness);
+         }
+
+         i2c::Master::init(i2c_frequency);
+         sequence::init(iomux.data());
          i2c_sequencer.process_event(start{});
       }
 
+      /// @brief Fold the effects and the dimming into the LED word, and mark the changed sides for writing
+      /// A side left as it is, with no write pending, counts as a write skipped.
+      void update_frame_buffer() {
+         uint16_t value = ((led_word & ~effect_mask) | (effect_on & effect_mask)) & slot_masks[dim_slot];
+
+         for (uint8_t e = 0; e < nb_expanders; ++e) {
+            uint8_t port = layout::ports.leds_to[e](value);
+
+            if ( port != frame_buffer[e] ) {
+               frame_buffer[e] = port;
+               dirty |= 1U << e;
+            } else if ( not (dirty & (1U << e)) ) {
+               registers::increment(registers::led_writes_skipped);
+            }
+         }
+
+         if ( dirty and i2c_sequencer.is("wait_for_poll"_s) ) {
+            react_on_flush.notify();
+         }
+      }
+
+      /// @brief Move to the next bit angle slot, which lasts its weight in units
+      void on_dim_slot() {
+         dim_slot = (dim_slot + 1) % dim_slots;
+         react_on_dim.delay(dim_unit * (1U << dim_slot));
+         update_frame_buffer();
+      }
+
+      /// @brief Evaluate the effects of all LEDs
+      void on_effect_tick() {
+         for (uint8_t i = 0; i < nb_leds; ++i) {
+            uint16_t bit = 1U << i;
+            uint16_t effect = registers::get(registers::index_t(registers::effects + i));
+            uint16_t param = effect & registers::effect_param_msk;
+            bool on = false;
+
+            if ( not (effect_mask & bit) ) {
+               continue;
+            }
+
+            switch (effect & registers::effect_mode_msk) {
+            case registers::effect_blink: {
+               uint8_t period = param >> 7;
+               on = effect_phase[i] < period / 2;
+               effect_phase[i] = (effect_phase[i] + 1) % period;
+               break;
+            }
+            case registers::effect_flash:
+               // Back to the LED word once done
+               if ( flash_left[i] == 0 ) {
+                  set_effect(i, registers::effect_steady);
+               } else {
+                  --flash_left[i];
+                  on = true;
+               }
+               break;
+            case registers::effect_pattern: {
+               uint8_t step_ticks = param >> 8;
+               on = (param >> (effect_phase[i] / step_ticks)) & 1;
+               effect_phase[i] = (effect_phase[i] + 1) % (8 * step_ticks);
+               break;
+            }
+            }
+
+            effect_on = on ? effect_on | bit : effect_on & ~bit;
+         }
+
+         update_frame_buffer();
+      }
+
       /// @brief Set the leds as one continuous buffer of 12 leds
       /// @param value 16 bits holder the 12bits
       void set_leds(uint16_t value) {
-         frame_buffer[0] = (value>>6) & io_msk;
-         frame_buffer[1] = value & io_msk;
+         led_word = value & layout::all_leds;
+         registers::set(registers::leds, led_word);
+         update_frame_buffer();
       }
 
-      /// @brief Get the leds as a 12-bits values
+      bool is_valid_effect(uint16_t effect) {
+         uint16_t param = effect & registers::effect_param_msk;
+
+         switch (effect & registers::effect_mode_msk) {
+         case registers::effect_blink:
+            return (param >> 7) >= 2;
+         case registers::effect_pattern:
+            return (param >> 8) != 0;
+         default:
+            return true;
+         }
+      }
+
+      bool set_effect(uint8_t index, uint16_t effect) {
+         uint16_t bit = 1U << index;
+         uint16_t param = effect & registers::effect_param_msk;
+
+         if ( not is_valid_effect(effect) ) {
+            return false;
+         }
+
+         switch (effect & registers::effect_mode_msk) {
+         case registers::effect_steady:
+            effect_mask &= ~bit;
+            break;
+         case registers::effect_blink:
+            effect_phase[index] = (param & 0x7f) % (param >> 7);
+            break;
+         case registers::effect_flash:
+            flash_left[index] = param;
+            break;
+         case registers::effect_pattern:
+            effect_phase[index] = 0;
+            break;
+         }
+
+         registers::set(registers::index_t(registers::effects + index), effect);
+
+         if ( effect != registers::effect_steady ) {
+            // Start the time base with the first effect
+            if ( effect_mask == 0 ) {
+               react_on_effects.repeat(effect_tick);
+            }
+
+            effect_mask |= bit;
+         } else if ( effect_mask == 0 ) {
+            react_on_effects.cancel();
+         }
+
+         update_frame_buffer();
+
+         return true;
+      }
+
+      bool is_valid_brightness(uint16_t level) {
+         return level <= full_brightness;
+      }
+
+      bool set_brightness(uint8_t index, uint8_t level) {
+         if ( not is_valid_brightness(level) ) {
+            return false;
+         }
+
+         bool dimmed = false;
+
+         registers::set(registers::index_t(registers::brightness + index), level);
+
+         for (uint8_t slot = 0; slot < dim_slots; ++slot) {
+            uint16_t bit = 1U << index;
+            slot_masks[slot] = (level >> slot) & 1 ? slot_masks[slot] | bit : slot_masks[slot] & ~bit;
+         }
+
+         // The slots only differ if some LED is neither off nor at full brightness
+         for (uint8_t slot = 1; slot < dim_slots; ++slot) {
+            dimmed = dimmed or slot_masks[slot] != slot_masks[0];
+         }
+
+         if ( dimmed and not dimming ) {
+            react_on_dim.delay(dim_unit * (1U << dim_slot));
+         } else if ( dimming and not dimmed ) {
+            react_on_dim.cancel();
+         }
+
+         dimming = dimmed;
+         update_frame_buffer();
+
+         return true;
+      }
+
+      /// @brief Get the leds as a 12-bits values, as set by the master
       uint16_t get_leds() {
-         return frame_buffer[0]<<6 | frame_buffer[1];
+         return led_word;
       }
 
+      /// @brief Get a LED, indexed as the bits of the 12-bits value
       bool get_led(uint8_t index) {
-         if ( index < 6 ) {
-            return (frame_buffer[0] >> index) & 1;
-         }
-         return (frame_buffer[1] >> (index-6)) & 1;
+         return (get_leds() >> index) & 1;
       }
 
+      /// @brief Set a LED, indexed as the bits of the 12-bits value
       void set_led(uint8_t index, bool on) {
-        uint8_t *frame = &frame_buffer[index / leds_per_side];
-        uint8_t mask = 1 << (index % leds_per_side);
-        if (on) {
-            *frame |= mask;
-        } else {
-            *frame &= (~mask);
-        }
+         uint16_t mask = 1U << index;
+         set_leds(on ? get_leds() | mask : get_leds() & ~mask);
       }
 
       // Return the active key
       uint8_t get_active_key_code() {
-         return active_key;
+         return gestures.get();
       }
 
       uint8_t get_switch_status() {
-         return integrator[1].current & 0x0f;
+         return layout::switches(inputs.get());
+      }
+
+      uint8_t get_key_event_count() {
+         return key_events_count;
+      }
+
+      void when_ready(void (*action)()) {
+         if ( registers::get(registers::status) & registers::initialising ) {
+            ready_action = action;
+         } else {
+            action();
+         }
+      }
+
+      bool pop_key_event(KeyEvent &event) {
+         if ( key_events_count == 0 ) {
+            return false;
+         }
+
+         event = key_events[key_events_first];
+         key_events_first = (key_events_first + 1) % MUX_KEY_EVENTS;
+
+         if ( --key_events_count == 0 ) {
+            registers::set_flags(registers::status, registers::key_events_pending, false);
+         }
+
+         return true;
       }
    }
 }
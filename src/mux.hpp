@@ -4,6 +4,15 @@
 
 namespace console {
    namespace mux {
+      /// @brief A change of the active key
+      struct KeyEvent {
+         static constexpr uint8_t press = 0x80; ///< Set in the code when pressed
+
+         uint8_t sequence;   ///< Incremented for each event, a gap shows lost events
+         uint8_t code;       ///< Key code, with the press flag and the kind of gesture (see gestures.hpp)
+         uint16_t timestamp; ///< Time of the event in ms (wraps)
+      };
+
       void init();
 
       // Set the LEDs values as a bloc of 12 bits
@@ -18,10 +27,31 @@ namespace console {
       // Set a single LED
       void set_led(uint8_t index, bool on);
 
+      // Check an effect, so a block of registers can be checked before any is set
+      bool is_valid_effect(uint16_t effect);
+
+      // Set the effect of a LED (see registers::effect_t). Returns false if invalid.
+      bool set_effect(uint8_t index, uint16_t effect);
+
+      // Check a brightness, 0 to 15
+      bool is_valid_brightness(uint16_t level);
+
+      // Set the brightness of a LED, 0 to 15. Returns false if invalid.
+      bool set_brightness(uint8_t index, uint8_t level);
+
       ///< Get the actively pushed key (stabilized, accounting for shift value)
       uint8_t get_active_key_code();
 
       ///< Get the switches status
       uint8_t get_switch_status();
+
+      ///< Number of key events waiting to be read
+      uint8_t get_key_event_count();
+
+      ///< Remove the oldest key event. Returns false if none is left.
+      bool pop_key_event(KeyEvent &event);
+
+      // Call an action once the inputs are first read, or at once if they are
+      void when_ready(void (*action)());
    }
 }
@@ -0,0 +1,302 @@
+#pragma once
+/**
+ * Compile-time description of the I/O expanders of a panel
+ * A board lists its PCA9555 expanders. On each, port 0 drives the LEDs and port 1 reads the
+ *  keys, the override switches and the shift key. Every pin is given its role, and the bit it
+ *  stands for in the LED word, the keys or the switches.
+ * The layout derives the masks and the bit moves used by the mux from the description. The bits
+ *  are moved in groups sharing the same distance, so a regular wiring costs a shift and a mask.
+ * A board may also list chords, keys held together reported as a code of their own.
+ */
+#include <stdint.h>
+#include <array>
+#include <initializer_list>
+#include <type_traits>
+
+namespace console {
+   namespace mux {
+      enum class role_t : uint8_t { none, led, key, switch_, shift };
+
+      struct Pin {
+         role_t role = role_t::none;
+         uint8_t index = 0;     ///< Bit in the LED word, the keys or the switches
+         bool inverted = false; ///< Input inverted by the expander, for an active low contact
+      };
+
+      constexpr Pin none() { return {}; }
+      constexpr Pin led(uint8_t index) { return {role_t::led, index}; }
+      constexpr Pin key(uint8_t index) { return {role_t::key, index}; }
+      constexpr Pin switch_(uint8_t index, bool inverted = false) { return {role_t::switch_, index, inverted}; }
+      constexpr Pin shift() { return {role_t::shift}; }
+
+      /// @return The keys of a chord, a bit each
+      constexpr uint16_t chord(std::initializer_list<uint8_t> keys) {
+         uint16_t mask = 0;
+
+         for (auto key : keys) {
+            mask |= 1U << key;
+         }
+
+         return mask;
+      }
+
+      struct Expander {
+         uint8_t address; ///< Set by the A0-A2 pins
+         Pin outputs[8];  ///< Port 0, bit 0 first
+         Pin inputs[8];   ///< Port 1, bit 0 first
+      };
+
+      /// Smallest unsigned type holding the bits
+      template<uint8_t BITS>
+      using uint_t =
+         std::conditional_t<BITS <= 8, uint8_t,
+         std::conditional_t<BITS <= 16, uint16_t,
+         std::conditional_t<BITS <= 32, uint32_t, uint64_t>>>;
+
+      /// Bits to move, from a position to another
+      struct Moves {
+         uint8_t from[64];
+         uint8_t to[64];
+         uint8_t count;
+
+         constexpr void add(uint8_t f, uint8_t t) {
+            from[count] = f;
+            to[count++] = t;
+         }
+
+         /// @return The number of distinct distances, each one costs a shift and a mask
+         constexpr uint8_t runs() const {
+            uint8_t n = 0;
+
+            for (uint8_t i = 0; i < count; ++i) {
+               bool seen = false;
+
+               for (uint8_t j = 0; j < i; ++j) {
+                  seen = seen or (to[j] - from[j]) == (to[i] - from[i]);
+               }
+
+               n += not seen;
+            }
+
+            return n;
+         }
+      };
+
+      /// @brief Gather bits of a word into another word, one shift and mask per run
+      template<typename FROM, typename TO, uint8_t RUNS>
+      struct BitMove {
+         struct Run {
+            int8_t shift;
+            FROM mask; ///< Bits taken from the source
+         };
+
+         Run runs[RUNS ? RUNS : 1] = {};
+
+         constexpr BitMove() = default;
+
+         constexpr BitMove(const Moves &moves) {
+            uint8_t n = 0;
+
+            for (uint8_t i = 0; i < moves.count; ++i) {
+               int8_t shift = moves.to[i] - moves.from[i];
+               uint8_t r = 0;
+
+               while ( r < n and runs[r].shift != shift ) {
+                  ++r;
+               }
+
+               if ( r == n ) {
+                  runs[n++].shift = shift;
+               }
+
+               runs[r].mask |= FROM(1) << moves.from[i];
+            }
+         }
+
+         constexpr TO operator()(FROM from) const {
+            TO to = 0;
+
+            for (auto &run : runs) {
+               to |= run.shift >= 0 ? TO((from & run.mask) << run.shift) : TO((from & run.mask) >> -run.shift);
+            }
+
+            return to;
+         }
+      };
+
+      /// Derivations from the board description, for the layout
+      namespace detail {
+         template<class BOARD>
+         constexpr uint8_t nb_expanders = sizeof(BOARD::expanders) / sizeof(Expander);
+
+         /// @return The number of bits of a role, from the highest index used
+         template<class BOARD>
+         constexpr uint8_t count(role_t role) {
+            uint8_t n = 0;
+
+            for (auto &expander : BOARD::expanders) {
+               for (uint8_t bit = 0; bit < 8; ++bit) {
+                  for (auto &pin : {expander.outputs[bit], expander.inputs[bit]}) {
+                     if ( pin.role == role and pin.index >= n ) {
+                        n = pin.index + 1;
+                     }
+                  }
+               }
+            }
+
+            return n;
+         }
+
+         /// @return The LED word bits to the port 0 of an expander
+         template<class BOARD>
+         constexpr Moves leds_to(uint8_t e) {
+            Moves moves{};
+
+            for (uint8_t bit = 0; bit < 8; ++bit) {
+               if ( BOARD::expanders[e].outputs[bit].role == role_t::led ) {
+                  moves.add(BOARD::expanders[e].outputs[bit].index, bit);
+               }
+            }
+
+            return moves;
+         }
+
+         /// @return The input bits of a role, to their index
+         template<class BOARD>
+         constexpr Moves inputs_of(role_t role) {
+            Moves moves{};
+
+            for (uint8_t e = 0; e < nb_expanders<BOARD>; ++e) {
+               for (uint8_t bit = 0; bit < 8; ++bit) {
+                  if ( BOARD::expanders[e].inputs[bit].role == role ) {
+                     moves.add(e * 8 + bit, BOARD::expanders[e].inputs[bit].index);
+                  }
+               }
+            }
+
+            return moves;
+         }
+
+         template<class BOARD>
+         constexpr uint8_t max_output_runs() {
+            uint8_t n = 0;
+
+            for (uint8_t e = 0; e < nb_expanders<BOARD>; ++e) {
+               n = leds_to<BOARD>(e).runs() > n ? leds_to<BOARD>(e).runs() : n;
+            }
+
+            return n;
+         }
+
+         /// Settings of the ports of each expander
+         template<class BOARD>
+         struct Ports {
+            using move_t = BitMove<uint16_t, uint8_t, max_output_runs<BOARD>()>;
+
+            move_t leds_to[nb_expanders<BOARD>];   ///< LED word to the port 0 of each expander
+            uint8_t outputs[nb_expanders<BOARD>];  ///< LED pins of each port 0
+            uint8_t inverted[nb_expanders<BOARD>]; ///< Inverted pins of each port 1
+
+            constexpr Ports() : leds_to{}, outputs{}, inverted{} {
+               for (uint8_t e = 0; e < nb_expanders<BOARD>; ++e) {
+                  leds_to[e] = move_t{detail::leds_to<BOARD>(e)};
+
+                  for (uint8_t bit = 0; bit < 8; ++bit) {
+                     outputs[e] |= (BOARD::expanders[e].outputs[bit].role == role_t::led) << bit;
+                     inverted[e] |= BOARD::expanders[e].inputs[bit].inverted << bit;
+                  }
+               }
+            }
+         };
+
+         /// @return The chords of the board, none if it lists none
+         template<class BOARD>
+         constexpr auto chords() {
+            if constexpr ( requires { BOARD::chords; } ) {
+               std::array<uint16_t, sizeof(BOARD::chords) / sizeof(uint16_t)> all{};
+
+               for (uint8_t i = 0; i < all.size(); ++i) {
+                  all[i] = BOARD::chords[i];
+               }
+
+               return all;
+            } else {
+               return std::array<uint16_t, 0>{};
+            }
+         }
+
+         /// @return The inputs which have a role
+         template<class BOARD, typename T>
+         constexpr T used_inputs() {
+            T mask = 0;
+
+            for (auto role : {role_t::key, role_t::switch_, role_t::shift}) {
+               auto moves = inputs_of<BOARD>(role);
+
+               for (uint8_t i = 0; i < moves.count; ++i) {
+                  mask |= T(1) << moves.from[i];
+               }
+            }
+
+            return mask;
+         }
+      }
+
+      /// @brief Everything the mux needs to know of a board, derived at compile time
+      /// BOARD provides a static constexpr array of Expander named expanders, and optionally one
+      ///  of chords.
+      /// Up to 8 expanders are read, but the words and the register map bound what a panel
+      ///  reports, whatever its number of expanders:
+      ///  - 12 LEDs: a coil, an effect and a brightness register each (checked by the mux)
+      ///  - 16 keys and 8 switches, gathered in a word and a byte
+      ///  - 31 key codes of 5 bits: each key plain and shifted, then the chords (see gestures.hpp)
+      /// A panel beyond these needs a new register map, not a new layout.
+      template<class BOARD>
+      struct Layout {
+         static constexpr auto &expanders = BOARD::expanders;
+         static constexpr uint8_t nb_expanders = detail::nb_expanders<BOARD>;
+
+         static_assert(nb_expanders > 0 and nb_expanders <= 8, "The PCA9555 has 8 addresses");
+
+         /// The inputs of all the expanders, the first one in the LSB
+         using inputs_t = uint_t<nb_expanders * 8>;
+
+         static constexpr uint8_t nb_leds = detail::count<BOARD>(role_t::led);
+         static constexpr uint8_t nb_keys = detail::count<BOARD>(role_t::key);
+         static constexpr uint8_t nb_switches = detail::count<BOARD>(role_t::switch_);
+
+         static_assert(nb_leds <= 16, "The LED word is 16 bits");
+         static_assert(nb_keys <= 16, "The keys are gathered in 16 bits");
+         static_assert(nb_switches <= 8, "The switches are reported in a byte");
+         static_assert(detail::count<BOARD>(role_t::shift) <= 1, "There is one shift key");
+
+         static constexpr uint16_t all_leds = (1UL << nb_leds) - 1;
+
+         static constexpr detail::Ports<BOARD> ports{};
+
+         static constexpr BitMove<inputs_t, uint16_t, detail::inputs_of<BOARD>(role_t::key).runs()>
+            keys{detail::inputs_of<BOARD>(role_t::key)};
+         static constexpr BitMove<inputs_t, uint8_t, detail::inputs_of<BOARD>(role_t::switch_).runs()>
+            switches{detail::inputs_of<BOARD>(role_t::switch_)};
+         static constexpr BitMove<inputs_t, uint8_t, detail::inputs_of<BOARD>(role_t::shift).runs()>
+            shift{detail::inputs_of<BOARD>(role_t::shift)};
+
+         static constexpr inputs_t inputs_mask = detail::used_inputs<BOARD, inputs_t>();
+
+         static constexpr auto chords = detail::chords<BOARD>();
+         static constexpr uint8_t nb_chords = chords.size();
+
+         static constexpr bool valid_chords() {
+            for (auto keys : chords) {
+               if ( (keys & (keys - 1)) == 0 or keys >= (1UL << nb_keys) ) {
+                  return false;
+               }
+            }
+
+            return true;
+         }
+
+         static_assert(valid_chords(), "A chord is made of several keys of the board");
+      };
+   }
+}
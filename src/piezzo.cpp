@@ -0,0 +1,61 @@
+/**
+ * Piezzo driver
+ * The piezzo is driven with a square wave from the TCA (PIEZZO_TCA) in split mode, its high half
+ *  on WO3 (PIEZZO_OUT). So the period is 8 bits, and the prescaler is picked for each note, the
+ *  lowest for the period to fit, for the frequency to be as accurate as can be.
+ * The notes are timed by the tune player. The asx piezzo driver parses its tunes at runtime,
+ *  which the compiled tunes do without.
+ */
+#include <avr/io.h>
+
+#include <asx/ioport.hpp>
+
+#include <conf_board.h>
+#include <conf_piezzo.h>
+
+#include "piezzo.hpp"
+
+using namespace asx;
+
+namespace console {
+   namespace piezzo {
+      namespace {
+         /// Divisions of the prescaler settings, as powers of 2
+         constexpr uint8_t prescaler_shifts[] = {0, 1, 2, 3, 4, 6, 8, 10};
+         constexpr uint8_t nb_prescalers = sizeof(prescaler_shifts);
+      }
+
+      void init() {
+         ioport::Pin(PIEZZO_OUT).init(ioport::dir_t::out);
+         PIEZZO_TCA.SPLIT.CTRLD = TCA_SPLIT_SPLITM_bm;
+      }
+
+      void tone(uint16_t frequency) {
+         // The pin is back to its port, low, so no current flows between the notes
+         PIEZZO_TCA.SPLIT.CTRLA = 0;
+         PIEZZO_TCA.SPLIT.CTRLB = 0;
+
+         if ( frequency == 0 ) {
+            return;
+         }
+
+         uint8_t clksel = 0;
+         uint32_t ticks = F_CPU / frequency;
+
+         while ( ticks > 256 and clksel < nb_prescalers - 1 ) {
+            ticks = (F_CPU >> prescaler_shifts[++clksel]) / frequency;
+         }
+
+         // The lowest notes are played as low as can be
+         if ( ticks > 256 ) {
+            ticks = 256;
+         }
+
+         PIEZZO_TCA.SPLIT.HCNT = 0;
+         PIEZZO_TCA.SPLIT.HPER = ticks - 1;
+         PIEZZO_TCA.SPLIT.HCMP0 = ticks / 2;
+         PIEZZO_TCA.SPLIT.CTRLB = TCA_SPLIT_HCMP0EN_bm;
+         PIEZZO_TCA.SPLIT.CTRLA = (clksel << TCA_SPLIT_CLKSEL_gp) | TCA_SPLIT_ENABLE_bm;
+      }
+   }
+}
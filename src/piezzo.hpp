@@ -0,0 +1,14 @@
+#pragma once
+
+/// Piezzo driver sounding the notes of the tune player
+
+#include <stdint.h>
+
+namespace console {
+   namespace piezzo {
+      void init();
+
+      /// @brief Sound the piezzo at a frequency until changed, 0 for silence (non blocking)
+      void tone(uint16_t frequency);
+   }
+}
@@ -0,0 +1,90 @@
+#pragma once
+/**
+ * Image of the console state as Modbus holding registers
+ * The registers are kept big endian, as sent on the line, so a read is a copy of the image.
+ * The image is maintained by the mux and the Modbus handlers as the state changes.
+ */
+#include <stdint.h>
+
+namespace console {
+   namespace registers {
+      /// The buzzer keeps its address from before the image, the others follow it. The LEDs come
+      ///  next, so a single write covers the buzzer and the LEDs.
+      enum index_t : uint8_t {
+         buzzer = 10,        ///< W Note or tune to play (see buzzer_t), reads 99. Registers 0-9 read 0.
+         leds,               ///< R/W LEDs as 12 bits
+         led_writes,         ///< LED writes issued to the expanders (wraps)
+         led_writes_skipped, ///< LED updates leaving an expander unchanged, so not written (wraps)
+         active_key,         ///< Key code, with shift
+         switches,           ///< Override switches, 4 bits
+         status,             ///< Status flags
+         change_sequence,    ///< Incremented on each change of the switches or the active key
+         effects,            ///< R/W Effect of each of the 12 LEDs
+         effects_end = effects + 12,
+         brightness = effects_end, ///< R/W Brightness of each of the 12 LEDs, 0-15
+         brightness_end = brightness + 12,
+         tune_tempo = brightness_end, ///< R/W Tempo of the uploaded tune, in beats per minute
+         tune,               ///< R/W Uploaded tune, a packed note per register (see tune::Note)
+         tune_end = tune + 32,
+         slave_address = tune_end, ///< R/W Modbus address of the console, 1-247, kept in EEPROM
+         baud_rate,          ///< R/W Line rate code (see baud_t), written twice to commit a change
+         ready_time,         ///< Time from the start to the first read of the inputs, in us (saturates)
+         count
+      };
+
+      /// LED effect: mode in the 2 MSB, parameters in the 14 LSB, in effect ticks
+      enum effect_t : uint16_t {
+         effect_steady = 0x0000,  ///< Follows the LED word
+         effect_blink = 0x4000,   ///< <period=7> <phase=7>, on for the first half of the period
+         effect_flash = 0x8000,   ///< <duration=14>, on for the duration then steady
+         effect_pattern = 0xC000, ///< <step=6> <pattern=8>, one bit per step, LSB first
+         effect_mode_msk = 0xC000,
+         effect_param_msk = 0x3FFF,
+      };
+
+      /// Values of the buzzer register
+      enum buzzer_t : uint16_t {
+         buzzer_silent = 0, ///< Stop any tune, 1 to 3 beep
+         buzzer_tune = 4,   ///< Play the uploaded tune
+         buzzer_read = 99,  ///< Read whatever was written, as before the image, for the masters probing it
+      };
+
+      /// Values of the baud rate register
+      enum baud_t : uint16_t {
+         baud_115200,
+         baud_230400,
+         baud_460800,
+         baud_1000000,
+         baud_count
+      };
+
+      /// Flags of the status register
+      enum status_t : uint16_t {
+         key_events_pending = 1U << 0, ///< Key events wait to be read with function 24
+         key_events_lost = 1U << 1,    ///< The key event queue overflowed since the last read
+         baud_uncommitted = 1U << 2,   ///< A new line rate is on trial, and reverts unless committed
+         initialising = 1U << 3,       ///< The inputs are not read yet, the key and switches are not valid
+         i2c_fault = 1U << 4,          ///< An expander is out of service, its inputs hold their last state
+      };
+
+      inline uint8_t image[count * 2];
+
+      inline uint16_t get(index_t index) {
+         return image[index * 2] << 8 | image[index * 2 + 1];
+      }
+
+      inline void set(index_t index, uint16_t value) {
+         image[index * 2] = value >> 8;
+         image[index * 2 + 1] = value & 0xff;
+      }
+
+      inline void increment(index_t index) {
+         set(index, get(index) + 1);
+      }
+
+      inline void set_flags(index_t index, uint16_t mask, bool on) {
+         auto value = get(index);
+         set(index, on ? value | mask : value & ~mask);
+      }
+   }
+}
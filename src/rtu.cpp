@@ -0,0 +1,74 @@
+/**
+ * Line timing of the Modbus RTU slave
+ * The silences are timed by a TCB (CONSOLE_RTU_TCB) in periodic interrupt mode, counting the
+ *  peripheral clock by 2. It is restarted by each character, and its interrupt stops it once the
+ *  silence has elapsed, takes the time for the turnaround, then notifies the frame handler.
+ * The rate is written to the BAUD register of the USART, which the asx UART sets once at init.
+ */
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#include <conf_console.h>
+
+#include "rtu.hpp"
+
+using namespace asx;
+
+namespace console {
+   namespace rtu {
+      namespace {
+         static_assert(F_CPU / 2 == 1000000000UL / tick_ns, "The timer ticks at CLK_PER/2");
+
+         reactor::Handle react_on_silence;
+         volatile bool silent = true;
+         chrono::steady_clock::time_point silence_end;
+      }
+
+      void init(reactor::handler_t on_silence) {
+         react_on_silence = reactor::bind(on_silence, reactor_prio_high);
+         CONSOLE_RTU_TCB.CTRLB = TCB_CNTMODE_INT_gc;
+         CONSOLE_RTU_TCB.INTCTRL = TCB_CAPT_bm;
+         CONSOLE_RTU_TCB.CTRLA = TCB_CLKSEL_DIV2_gc;
+      }
+
+      void set_baud(uint32_t baud) {
+         // BAUD holds the clocks per bit in 1/64th, of which a sample takes 16, or 8 at double speed
+         uint8_t shift = (USART1.CTRLB & USART_RXMODE_gm) == USART_RXMODE_CLK2X_gc ? 3 : 2;
+
+         USART1.BAUD = ((F_CPU << shift) + baud / 2) / baud;
+      }
+
+      void restart(uint16_t ticks) {
+         CONSOLE_RTU_TCB.CTRLA = TCB_CLKSEL_DIV2_gc;
+         CONSOLE_RTU_TCB.CNT = 0;
+         CONSOLE_RTU_TCB.CCMP = ticks;
+         CONSOLE_RTU_TCB.INTFLAGS = TCB_CAPT_bm;
+         silent = false;
+         CONSOLE_RTU_TCB.CTRLA = TCB_CLKSEL_DIV2_gc | TCB_ENABLE_bm;
+      }
+
+      uint16_t elapsed() {
+         return silent ? 0xffff : CONSOLE_RTU_TCB.CNT;
+      }
+
+      chrono::steady_clock::time_point silent_since() {
+         return silence_end;
+      }
+
+      Critical::Critical() : sreg{SREG} {
+         cli();
+      }
+
+      Critical::~Critical() {
+         SREG = sreg;
+      }
+   }
+}
+
+ISR(CONSOLE_RTU_TCB_vect) {
+   CONSOLE_RTU_TCB.CTRLA = TCB_CLKSEL_DIV2_gc;
+   CONSOLE_RTU_TCB.INTFLAGS = TCB_CAPT_bm;
+   console::rtu::silent = true;
+   console::rtu::silence_end = chrono::steady_clock::now();
+   console::rtu::react_on_silence.notify();
+}
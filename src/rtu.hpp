@@ -0,0 +1,160 @@
+#pragma once
+/**
+ * Modbus RTU slave of the console
+ * The frames are delimited by the silences on the line. The RX ISR only stores the character and
+ *  restarts the silence timer, which calls the frame handler once the line is silent for T3.5.
+ *  A silence over T1.5 within a frame breaks it, and the frame is dropped.
+ * The handler may be late, as the reactor finishes another handler. A character received once
+ *  T3.5 elapsed then starts the next frame: up to CONSOLE_RTU_BACKLOG of them are kept aside,
+ *  and handed to the datagram once the handler is done with the previous frame. The reply to
+ *  that frame is dropped, as the master has moved on.
+ * The turnaround is timed from the interrupt ending the silence to the start of the reply.
+ * The line rate can change at runtime. Above 19200 baud, T1.5 and T3.5 are fixed to 750us and
+ *  1.75ms as the Modbus spec requires, below they are 1.5 and 3.5 characters.
+ * It replaces the asx slave, which times the frames for the rate of the UART configuration.
+ */
+#include <stdint.h>
+
+#include <asx/chrono.hpp>
+#include <asx/reactor.hpp>
+
+#include <conf_console.h>
+
+#include "diagnostics.hpp"
+
+namespace console {
+   namespace rtu {
+      /// Bits of a character on the line: the start bit, 8 data bits, the parity and the stop bit
+      constexpr uint8_t bits_per_char = 11;
+
+      /// Duration of a tick of the silence timer in ns, which counts up to 0xffff (6.5ms)
+      constexpr uint32_t tick_ns = 100;
+
+      /// @brief Time the silences, the handler is called at high priority once one has elapsed
+      void init(asx::reactor::handler_t on_silence);
+
+      /// @brief Change the rate of the UART, keeping its format. Characters in progress are garbled.
+      void set_baud(uint32_t baud);
+
+      /// @brief Time a silence from now (from the RX ISR)
+      void restart(uint16_t ticks);
+
+      /// @return Ticks since the last restart, 0xffff once the silence has elapsed
+      uint16_t elapsed();
+
+      /// @return The time the last silence elapsed, taken by its interrupt
+      asx::chrono::steady_clock::time_point silent_since();
+
+      /// Masks the interrupts for its lifetime
+      class Critical {
+         uint8_t sreg;
+      public:
+         Critical();
+         ~Critical();
+      };
+
+      template<class DATAGRAM, class UART>
+      class Slave {
+         /// End of a character to the end of the next one, over which the frame is broken
+         static inline uint16_t max_gap;
+         static inline uint16_t t3_5;
+         static inline bool receiving = false;
+         static inline bool broken = false;
+
+         /// Characters of the next frame, received before the handler took the previous one
+         static inline uint8_t next[CONSOLE_RTU_BACKLOG];
+         static inline uint8_t nb_next = 0;
+         static inline volatile bool next_started = false;
+         static inline bool next_broken = false;
+
+         static constexpr uint16_t ticks(uint32_t us) {
+            return us * 1000 / tick_ns;
+         }
+
+         static void on_character(uint8_t c) {
+            if ( receiving and (next_started or elapsed() == 0xffff) ) {
+               // The frame is complete, but the handler has not taken it yet
+               if ( (next_started and elapsed() > max_gap) or nb_next == sizeof(next) ) {
+                  next_broken = true;
+               } else {
+                  next[nb_next++] = c;
+               }
+
+               next_started = true;
+            } else {
+               if ( receiving and elapsed() > max_gap ) {
+                  broken = true;
+               }
+
+               receiving = true;
+               DATAGRAM::process_char(c);
+            }
+
+            restart(t3_5);
+         }
+
+         /// @brief Start over with the frame received while the previous one was handled, if any
+         /// The characters are handed one at a time, for the interrupts to be masked no longer than
+         ///  the RX ISR takes. Meanwhile, the new ones are still kept aside.
+         static void take_next() {
+            DATAGRAM::reset();
+
+            for (uint8_t taken = 0;; ++taken) {
+               Critical critical;
+
+               if ( taken == nb_next ) {
+                  receiving = next_started;
+                  broken = next_broken;
+                  next_started = false;
+                  next_broken = false;
+                  nb_next = 0;
+                  return;
+               }
+
+               DATAGRAM::process_char(next[taken]);
+            }
+         }
+
+         static void on_frame() {
+            // The next frame may be complete too, if the handler is later than its T3.5
+            while ( receiving and (next_started or elapsed() == 0xffff) ) {
+               if ( not broken and DATAGRAM::get_status() == DATAGRAM::status_t::GOOD_FRAME ) {
+                  DATAGRAM::ready_reply();
+
+                  // A frame may be ignored, or answered later by the application
+                  if ( DATAGRAM::get_buffer().size() and not next_started ) {
+                     using namespace std::chrono;
+                     auto us = duration_cast<microseconds>(asx::chrono::steady_clock::now() - silent_since());
+
+                     UART::send(DATAGRAM::get_buffer());
+                     diagnostics::record(diagnostics::turnaround, diagnostics::turnaround_base, us.count());
+                  }
+               }
+
+               take_next();
+            }
+         }
+
+      public:
+         /// @param baud The rate the UART is configured with
+         static void init(uint32_t baud) {
+            DATAGRAM::reset();
+            UART::init();
+            set_baud(baud);
+            UART::react_on_character_received(on_character);
+            rtu::init(on_frame);
+         }
+
+         /// @brief Change the line rate, and the silences which delimit the frames
+         static void set_baud(uint32_t baud) {
+            uint32_t char_ticks = bits_per_char * (1000000000UL / tick_ns) / baud;
+            uint32_t t1_5 = baud > 19200 ? ticks(750) : char_ticks * 3 / 2;
+            uint32_t t3_5_ticks = baud > 19200 ? ticks(1750) : char_ticks * 7 / 2;
+
+            rtu::set_baud(baud);
+            max_gap = t1_5 + char_ticks < 0xffff ? t1_5 + char_ticks : 0xfffe;
+            t3_5 = t3_5_ticks < 0xffff ? t3_5_ticks : 0xfffe;
+         }
+      };
+   }
+}
@@ -0,0 +1,80 @@
+/**
+ * Sequences of transfers to the I/O expanders
+ * The PCA9555 driver takes the port as a template parameter, so each transfer is dispatched to
+ *  the call for its port.
+ */
+#include <alert.h>
+
+#include "sequence.hpp"
+
+using namespace asx;
+using namespace asx::i2c;
+
+namespace console {
+   namespace sequence {
+      namespace {
+         PCA9555 *expanders = nullptr;
+         const Transfer *transfers = nullptr;
+         uint8_t nb_transfers = 0;
+         uint8_t nb_completed = 0;
+         callback_t callback = nullptr;
+
+         void on_transfer(status_code_t code);
+
+         template<uint8_t PORT>
+         void start(PCA9555 &expander, const Transfer &transfer) {
+            switch (transfer.op) {
+            case Transfer::set_value:
+               expander.set_value<PORT>(*transfer.value, on_transfer);
+               break;
+            case Transfer::set_dir:
+               expander.set_dir<PORT>(*transfer.value, on_transfer);
+               break;
+            case Transfer::set_pol:
+               expander.set_pol<PORT>(*transfer.value, on_transfer);
+               break;
+            case Transfer::read:
+               expander.read<PORT>(on_transfer);
+               break;
+            }
+         }
+
+         void start_next() {
+            auto &transfer = transfers[nb_completed];
+            auto &expander = expanders[transfer.expander];
+
+            if ( transfer.port ) {
+               start<1>(expander, transfer);
+            } else {
+               start<0>(expander, transfer);
+            }
+         }
+
+         void on_transfer(status_code_t code) {
+            if ( code == status_code_t::STATUS_OK and ++nb_completed < nb_transfers ) {
+               start_next();
+            } else {
+               callback(code);
+            }
+         }
+      }
+
+      void init(PCA9555 *all) {
+         expanders = all;
+      }
+
+      void run(const Transfer *all, uint8_t count, callback_t cb) {
+         alert_and_stop_if(expanders == nullptr or count == 0);
+
+         transfers = all;
+         nb_transfers = count;
+         nb_completed = 0;
+         callback = cb;
+         start_next();
+      }
+
+      uint8_t completed() {
+         return nb_completed;
+      }
+   }
+}
@@ -0,0 +1,34 @@
+#pragma once
+/**
+ * Sequences of transfers to the I/O expanders
+ * The transfers run one after the other on the PCA9555 driver, each started from the completion
+ *  of the previous one, without a round through the mux. The sequence completes once, after the
+ *  last transfer or the first one which fails.
+ * Each transfer is still a transaction of its own on the bus, with its start and stop, and its
+ *  completion dispatched by the reactor. Only the round through the mux state machine is saved.
+ */
+#include <stdint.h>
+
+#include <asx/pca9555.hpp>
+
+namespace console {
+   namespace sequence {
+      struct Transfer {
+         enum op_t : uint8_t { set_value, set_dir, set_pol, read };
+
+         op_t op;
+         uint8_t port;
+         uint8_t expander;     ///< Index in the expanders given to init
+         const uint8_t *value; ///< Taken as the transfer starts, unused by a read
+      };
+
+      /// @brief Set the expanders the transfers are for
+      void init(asx::i2c::PCA9555 *expanders);
+
+      /// @brief Run the transfers, which must stay valid until the callback
+      void run(const Transfer *transfers, uint8_t count, asx::i2c::callback_t cb);
+
+      /// @return Transfers of the last sequence which completed, so the index of the one which failed
+      uint8_t completed();
+   }
+}
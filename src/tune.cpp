@@ -0,0 +1,95 @@
+/**
+ * Non blocking player of the compiled tunes
+ * Each note is started by a low priority reactor handler, which only sets the piezzo frequency
+ *  and the timer to the next note. So the Modbus handlers are never held up by a tune.
+ * Notes which are not slurred end with a short silence, for the next one to be heard apart.
+ */
+#include <asx/reactor.hpp>
+
+#include "piezzo.hpp"
+#include "tune.hpp"
+
+using namespace asx;
+using namespace std::chrono;
+
+namespace console {
+   namespace tune {
+      namespace {
+         /// Frequencies of the 8th octave, the lower octaves are shifted down
+         constexpr uint16_t octave_8[] = {4186, 4435, 4699, 4978, 5274, 5588, 5920, 6272, 6645, 7040, 7459, 7902};
+
+         const Note *next = nullptr;
+         uint8_t left = 0;
+         milliseconds beat;
+
+         /// Silence between 2 notes, 1/8 of a beat
+         milliseconds gap;
+
+         /// The note sounding must end with a gap
+         bool gap_due = false;
+
+         reactor::Handle react_on_note;
+
+         void on_note() {
+            if ( gap_due ) {
+               gap_due = false;
+               piezzo::tone(0);
+               react_on_note.delay(gap);
+               return;
+            }
+
+            if ( left == 0 or next->beats == 0 ) {
+               stop();
+               return;
+            }
+
+            auto note = *next++;
+            auto length = beat * note.beats;
+            --left;
+
+            piezzo::tone(frequency(note.pitch & ~Note::slur));
+
+            // The last note and the rests need no gap
+            gap_due = not (note.pitch & Note::slur) and (note.pitch & ~Note::slur) != Note::rest and left;
+
+            react_on_note.delay(gap_due ? length - gap : length);
+         }
+      }
+
+      uint16_t frequency(uint8_t pitch) {
+         if ( pitch == Note::rest ) {
+            return 0;
+         }
+
+         // MIDI octaves start at -1
+         uint8_t octave = pitch / 12;
+
+         if ( octave > 9 ) {
+            octave = 9;
+         }
+
+         return octave_8[pitch % 12] >> (9 - octave);
+      }
+
+      void play(uint8_t tempo, const Note *notes, uint8_t size) {
+         next = notes;
+         left = size;
+         beat = duration_cast<milliseconds>(minutes{1}) / tempo;
+         gap = beat / 8;
+         gap_due = false;
+         on_note();
+      }
+
+      void stop() {
+         left = 0;
+         gap_due = false;
+         react_on_note.cancel();
+         piezzo::tone(0);
+      }
+
+      void init() {
+         piezzo::init();
+         react_on_note = reactor::bind(on_note);
+      }
+   }
+}
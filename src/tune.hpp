@@ -0,0 +1,148 @@
+#pragma once
+/**
+ * Piezzo tunes compiled at build time
+ * A tune is written as text, and turned by the compiler into a constant table of notes, which
+ *  stays in flash. Nothing is parsed on the target.
+ * The notation is a list of notes separated by spaces: <letter>[#][octave][beats][~]
+ *  - letter: A to G, or R for a rest
+ *  - #: sharp
+ *  - octave: each ' raises and each , lowers the 4th octave (C is the middle C)
+ *  - beats: length in beats, 1 if omitted
+ *  - ~: slurs into the next note, which follows without a space
+ * For instance: "C,3 R C E G" or "A2~A3".
+ * The same packed notes fill the tune slot of the register image, for the master to upload.
+ */
+#include <stdint.h>
+
+namespace console {
+   namespace tune {
+      /// @brief A packed note: 2 bytes, in the order of a big endian register
+      struct Note {
+         static constexpr uint8_t slur = 0x80;  ///< Set in the pitch to follow on without a gap
+         static constexpr uint8_t rest = 0;     ///< Pitch of a rest
+
+         uint8_t pitch;   ///< MIDI note number (60 is the middle C), with the slur flag
+         uint8_t beats;   ///< Length in beats, 0 ends a tune
+      };
+
+      static_assert(sizeof(Note) == 2, "A note must fit a register");
+
+      /// @brief The text of a tune, as a template parameter
+      template<uint8_t N>
+      struct Text {
+         char value[N];
+
+         constexpr Text(const char (&text)[N]) : value{} {
+            for (uint8_t i = 0; i < N; ++i) {
+               value[i] = text[i];
+            }
+         }
+      };
+
+      template<uint8_t N>
+      struct Tune {
+         Note notes[N];
+      };
+
+      namespace detail {
+         /// Not constexpr, so a bad notation stops the compilation where it is called
+         void invalid_tune_notation();
+
+         /// Semitones of the letters A to G from C
+         constexpr uint8_t semitones[] = {9, 11, 0, 2, 4, 5, 7};
+
+         constexpr bool is_separator(char c) {
+            return c == ' ' or c == '~' or c == '\0';
+         }
+
+         template<uint8_t N>
+         consteval uint8_t count(const Text<N> &text) {
+            uint8_t notes = 0;
+
+            for (uint8_t i = 0; i < N; ++i) {
+               notes += not is_separator(text.value[i]) and (i == 0 or is_separator(text.value[i - 1]));
+            }
+
+            return notes;
+         }
+
+         template<uint8_t SIZE, uint8_t N>
+         consteval Tune<SIZE> compile(const Text<N> &text) {
+            Tune<SIZE> tune{};
+            uint8_t n = 0;
+            uint8_t i = 0;
+
+            while ( n < SIZE ) {
+               while ( text.value[i] == ' ' ) {
+                  ++i;
+               }
+
+               char letter = text.value[i++];
+               int pitch = 0;
+
+               if ( letter >= 'A' and letter <= 'G' ) {
+                  pitch = 60 + semitones[letter - 'A'];
+
+                  if ( text.value[i] == '#' ) {
+                     ++pitch;
+                     ++i;
+                  }
+
+                  for (; text.value[i] == '\'' or text.value[i] == ','; ++i) {
+                     pitch += text.value[i] == '\'' ? 12 : -12;
+                  }
+               } else if ( letter != 'R' ) {
+                  invalid_tune_notation();
+               }
+
+               int beats = 0;
+
+               for (; text.value[i] >= '0' and text.value[i] <= '9'; ++i) {
+                  beats = beats * 10 + text.value[i] - '0';
+               }
+
+               if ( beats == 0 ) {
+                  beats = 1;
+               }
+
+               if ( pitch < 0 or pitch >= Note::slur or beats > 255 or not is_separator(text.value[i]) ) {
+                  invalid_tune_notation();
+               }
+
+               if ( text.value[i] == '~' ) {
+                  pitch |= Note::slur;
+                  ++i;
+               }
+
+               tune.notes[n++] = Note{uint8_t(pitch), uint8_t(beats)};
+            }
+
+            return tune;
+         }
+      }
+
+      /// @brief Compile a tune: constexpr auto jingle = tune::compile<"C E G C'2">();
+      template<Text TEXT>
+      consteval auto compile() {
+         return detail::compile<detail::count(TEXT)>(TEXT);
+      }
+
+      /// @return The frequency of a note in Hz, 0 for a rest
+      uint16_t frequency(uint8_t pitch);
+
+      /// @brief Start playing notes from the given table, stopping any tune playing
+      /// The table must remain valid while playing. A note of 0 beats ends the tune early.
+      /// @param tempo Beats per minute
+      void play(uint8_t tempo, const Note *notes, uint8_t size);
+
+      template<uint8_t N>
+      void play(uint8_t tempo, const Tune<N> &tune) {
+         play(tempo, tune.notes, N);
+      }
+
+      /// @brief Silence the piezzo
+      void stop();
+
+      void init();
+   }
+}
@@ -0,0 +1,22 @@
+#pragma once
+/**
+ * Stand-in for the asx alert
+ * A fatal firmware alert ends the simulation, or is reported and ends the benchmark.
+ */
+#ifdef SIM
+#  include <cstdio>
+#  include <cstdlib>
+
+#  define alert_and_stop() \
+   do { fprintf(stderr, "ALERT %s:%d\n", __FILE__, __LINE__); exit(3); } while (0)
+
+#  define alert_and_stop_if(cond) \
+   do { if ( cond ) { fprintf(stderr, "ALERT %s:%d: %s\n", __FILE__, __LINE__, #cond); exit(3); } } while (0)
+#else
+#  include "wcet.hpp"
+
+#  define alert_and_stop() wcet::alert(__FILE__, __LINE__)
+
+#  define alert_and_stop_if(cond) \
+   do { if ( cond ) { wcet::alert(__FILE__, __LINE__); } } while (0)
+#endif
@@ -0,0 +1,37 @@
+#pragma once
+/**
+ * Stand-in for the asx steady clock
+ * The time since power-up is the virtual time of the simulation (in ns), or the time advanced by
+ *  the benchmark (in us).
+ */
+#include <chrono>
+
+#ifdef SIM
+#  include "sim.hpp"
+#else
+#  include "wcet.hpp"
+#endif
+
+namespace asx {
+   namespace chrono {
+      struct steady_clock {
+#ifdef SIM
+         using duration = std::chrono::nanoseconds;
+#else
+         using duration = std::chrono::microseconds;
+#endif
+         using rep = duration::rep;
+         using period = duration::period;
+         using time_point = std::chrono::time_point<steady_clock>;
+         static constexpr bool is_steady = true;
+
+         static time_point now() noexcept {
+#ifdef SIM
+            return time_point{duration{sim::now()}};
+#else
+            return time_point{duration{wcet::now()}};
+#endif
+         }
+      };
+   }
+}
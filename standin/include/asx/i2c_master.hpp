@@ -0,0 +1,40 @@
+#pragma once
+/**
+ * Stand-in for the asx I2C master
+ * Transfers complete on the virtual clock after the time they take on the bus in the simulation,
+ *  or as the benchmark runs, the time on the bus not accounted.
+ */
+#include <stdint.h>
+
+#include <asx/reactor.hpp>
+
+typedef enum status_code {
+   STATUS_OK = 0,
+   ERR_IO_ERROR = -1,
+   ERR_FLUSHED = -2,
+   ERR_TIMEOUT = -3,
+   ERR_BAD_DATA = -4,
+   ERR_PROTOCOL = -5,
+   ERR_BUSY = -7,
+} status_code_t;
+
+namespace asx {
+   namespace i2c {
+      using callback_t = void (*)(status_code_t);
+
+      constexpr uint32_t operator""_KHz(unsigned long long value) {
+         return value * 1000;
+      }
+
+      class Master {
+      public:
+         static void init(uint32_t frequency);
+
+         /// @brief Write to the registers of a chip, starting at reg
+         static void write(uint8_t chip, uint8_t reg, const uint8_t *data, uint8_t size, callback_t cb);
+
+         /// @brief Read from the registers of a chip, starting at reg
+         static void read(uint8_t chip, uint8_t reg, uint8_t *data, uint8_t size, callback_t cb);
+      };
+   }
+}
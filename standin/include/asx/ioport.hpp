@@ -0,0 +1,36 @@
+#pragma once
+/**
+ * Stand-in for the asx ioport
+ * Only the inputs wired to the models are simulated, such as the expanders /INT line.
+ * A pin change interrupt notifies a reactor handle, as the pin ISR would.
+ */
+#include <stdint.h>
+
+#include <asx/reactor.hpp>
+
+enum : uint8_t { IOPORT_PORTA, IOPORT_PORTB, IOPORT_PORTC };
+
+/// The port is pasted, so the name is not taken for the port registers of <avr/io.h>
+#define IOPORT_CREATE_PIN(port, pin) uint8_t(IOPORT_##port * 8 + (pin))
+
+namespace asx {
+   namespace ioport {
+      enum class dir_t : uint8_t { in, out };
+      enum class pullup_t : uint8_t { none, up };
+
+      class Pin {
+         uint8_t pin;
+
+      public:
+         explicit constexpr Pin(uint8_t pin) : pin{pin} {}
+
+         void init(dir_t dir, pullup_t pullup = pullup_t::none) const;
+
+         /// @return The level of the pin
+         bool get() const;
+
+         /// @brief Notify a handler on each falling edge of the pin
+         void react_on_falling(reactor::Handle handle) const;
+      };
+   }
+}
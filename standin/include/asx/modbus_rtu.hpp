@@ -0,0 +1,19 @@
+#pragma once
+/**
+ * Stand-in for the asx Modbus RTU header
+ * Only the error codes are used, the slave is the console own (see src/rtu.hpp).
+ */
+#include <stdint.h>
+
+namespace asx {
+   namespace modbus {
+      enum class error_t : uint8_t {
+         ok = 0,
+         illegal_function_code = 1,
+         illegal_data_address = 2,
+         illegal_data_value = 3,
+         slave_device_failure = 4,
+         ignore_frame = 0xff
+      };
+   }
+}
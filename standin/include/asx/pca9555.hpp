@@ -0,0 +1,49 @@
+#pragma once
+/**
+ * Stand-in for the asx PCA9555 driver
+ */
+#include <asx/i2c_master.hpp>
+
+namespace asx {
+   namespace i2c {
+      class PCA9555 {
+         static constexpr uint8_t base_address = 0x20;
+
+         enum : uint8_t { input = 0, output = 2, polarity = 4, config = 6 };
+
+         uint8_t chip;
+         uint8_t data[2];
+
+         template<uint8_t PORT>
+         void write(uint8_t reg, uint8_t value, callback_t cb) {
+            static_assert(PORT < 2, "The PCA9555 has 2 ports");
+            data[PORT] = value;
+            Master::write(chip, reg + PORT, &data[PORT], 1, cb);
+         }
+
+      public:
+         explicit constexpr PCA9555(uint8_t address) : chip{uint8_t(base_address + address)}, data{} {}
+
+         template<uint8_t PORT>
+         void set_value(uint8_t value, callback_t cb) { write<PORT>(output, value, cb); }
+
+         template<uint8_t PORT>
+         void set_dir(uint8_t value, callback_t cb) { write<PORT>(config, value, cb); }
+
+         template<uint8_t PORT>
+         void set_pol(uint8_t value, callback_t cb) { write<PORT>(polarity, value, cb); }
+
+         /// @brief Read the input port. The value is available with get_value once complete.
+         template<uint8_t PORT>
+         void read(callback_t cb) {
+            static_assert(PORT < 2, "The PCA9555 has 2 ports");
+            Master::read(chip, input + PORT, &data[0], 1, cb);
+         }
+
+         template<typename T>
+         T get_value() const {
+            return static_cast<T>(data[0]);
+         }
+      };
+   }
+}
@@ -0,0 +1,48 @@
+#pragma once
+/**
+ * Stand-in for the asx reactor
+ * Handlers are dispatched by priority from the main loop of the simulation, between the model
+ *  events, or as the benchmark runs. Timers run on the steady clock of the stand-ins.
+ */
+#include <stdint.h>
+
+#include <asx/chrono.hpp>
+
+typedef enum {
+   reactor_prio_low = 0,
+   reactor_prio_high
+} reactor_priority_t;
+
+namespace asx {
+   namespace reactor {
+      using handler_t = void (*)();
+
+      class Handle {
+         uint8_t id;
+
+      public:
+         constexpr Handle() : id{0xff} {}
+         explicit constexpr Handle(uint8_t id) : id{id} {}
+
+         /// @brief Mark the handler as ready to be dispatched
+         void notify();
+
+         /// @brief Notify once after a delay. Replaces any pending timer of this handle.
+         void delay(chrono::steady_clock::duration delay);
+
+         /// @brief Notify periodically. Replaces any pending timer of this handle.
+         void repeat(chrono::steady_clock::duration period);
+
+         /// @brief Cancel the pending timer of this handle
+         void cancel();
+      };
+
+      /// @brief Register a handler
+      Handle bind(handler_t handler, reactor_priority_t prio = reactor_prio_low);
+
+#ifdef SIM
+      /// @brief Dispatch the handlers. Ends the simulation once its duration has elapsed.
+      [[noreturn]] void run();
+#endif
+   }
+}
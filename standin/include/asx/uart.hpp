@@ -0,0 +1,74 @@
+#pragma once
+/**
+ * Stand-in for the asx UART
+ * In the simulation, the UART is attached to the RS485 line model. Its rate is changed by the
+ *  line timing of the Modbus slave (see sim/rtu.cpp).
+ * In the benchmark, the characters are fed to the datagram by the benchmark, the replies are
+ *  dropped.
+ */
+#include <stdint.h>
+#include <string_view>
+
+#ifdef SIM
+#  include "sim.hpp"
+#endif
+
+namespace asx {
+   namespace uart {
+      enum class width : uint8_t { _5 = 5, _6, _7, _8 };
+      enum class parity : uint8_t { none, even, odd };
+      enum class stop : uint8_t { _1 = 1, _2 };
+
+      enum : uint8_t {
+         rs485 = 1 << 0,
+         onewire = 1 << 1
+      };
+
+      template<uint32_t BAUD, width WIDTH, parity PARITY, stop STOP, uint8_t FLAGS = 0>
+      struct CompileTimeConfig {
+         static constexpr uint32_t baud = BAUD;
+
+         /// Start bit + data + parity + stop bits
+         static constexpr uint8_t bits_per_char =
+            1 + uint8_t(WIDTH) + (PARITY == parity::none ? 0 : 1) + uint8_t(STOP);
+      };
+
+      template<uint8_t N, class CONFIG>
+      class Uart {
+#ifdef SIM
+         static inline void (*rx_handler)(uint8_t) = nullptr;
+         static inline sim::Probe probe_rx{"uart rx"};
+
+         static void on_receive(uint8_t c) {
+            sim::Probe::Measure measure{probe_rx};
+            rx_handler(c);
+         }
+#endif
+
+      public:
+         using config = CONFIG;
+         using rx_handler_t = void (*)(uint8_t);
+
+         static void init() {
+#ifdef SIM
+            sim::rs485::configure(CONFIG::baud, CONFIG::bits_per_char);
+#endif
+         }
+
+         /// @brief Set the handler called (from the ISR) for each character received
+         static void react_on_character_received(rx_handler_t handler) {
+#ifdef SIM
+            rx_handler = handler;
+            sim::rs485::slave_on_receive(on_receive);
+#endif
+         }
+
+         /// @brief Send the buffer. The data is copied.
+         static void send(std::string_view view) {
+#ifdef SIM
+            sim::rs485::slave_send(reinterpret_cast<const uint8_t *>(view.data()), view.size());
+#endif
+         }
+      };
+   }
+}
@@ -0,0 +1,7 @@
+#pragma once
+/**
+ * Stand-in for the asx debug traces
+ */
+enum debug_level_t { INFO, WARN, ERR };
+
+inline void debug_init(debug_level_t) {}
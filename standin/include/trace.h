@@ -0,0 +1,7 @@
+#pragma once
+/**
+ * Stand-in for the asx traces
+ */
+#define TRACE_INFO(...)
+#define TRACE_WARN(...)
+#define TRACE_ERROR(...)
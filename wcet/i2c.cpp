@@ -0,0 +1,150 @@
+/**
+ * Benchmark stand-in of the I2C master and of the PCA9555 expanders on the bus
+ * A transfer is held until the benchmark completes it, the time on the bus is not accounted.
+ * It takes effect, then the callback is called, as the master ISR would.
+ * The /INT output of an expander is asserted while an input differs from the value last read
+ *  from its port. The outputs of all the expanders are wired together to MUX_INT_PIN.
+ * An expander can be made to not answer a number of transfers, for the recovery to run.
+ */
+#include <alert.h>
+#include <asx/i2c_master.hpp>
+#include <asx/ioport.hpp>
+#include <conf_board.h>
+
+#include "wcet.hpp"
+
+namespace {
+   /// PCA9555 register map
+   enum : uint8_t { input = 0, output = 2, polarity = 4, config = 6 };
+
+   struct Expander {
+      uint8_t reg[8] = {0, 0, 0xff, 0xff, 0, 0, 0xff, 0xff};
+      uint8_t pins[2] = {0, 0}; ///< Level driven externally on each port
+      uint8_t captured[2] = {0, 0}; ///< Input port value as last read, reference for /INT
+      uint8_t nacks = 0; ///< Transfers left to not answer
+
+      /// Pins configured as outputs read back the output register
+      uint8_t input_port(uint8_t port) const {
+         auto dir = reg[config + port];
+         auto level = (pins[port] & dir) | (reg[output + port] & ~dir);
+         return level ^ reg[polarity + port];
+      }
+
+      /// /INT is only asserted by the pins configured as inputs
+      bool interrupting() const {
+         for (uint8_t port = 0; port < 2; ++port) {
+            if ( (input_port(port) ^ captured[port]) & reg[config + port] ) {
+               return true;
+            }
+         }
+
+         return false;
+      }
+   };
+
+   constexpr uint8_t base_address = 0x20;
+   constexpr uint8_t nb_addresses = 8;
+
+   Expander expanders[nb_addresses];
+
+   /// Transfer in progress
+   struct Transfer {
+      bool write;
+      uint8_t chip;
+      uint8_t reg;
+      uint8_t *data;
+      uint8_t size;
+   } pending;
+
+   asx::i2c::callback_t callback = nullptr;
+
+   wcet::Probe probe_callback{"i2c completion", wcet::i2c_budget};
+
+   /// The open drain /INT outputs pull the line low together
+   void update_int() {
+      bool asserted = false;
+
+      for (auto &expander : expanders) {
+         asserted = asserted or expander.interrupting();
+      }
+
+      wcet::ioport::drive(MUX_INT_PIN, not asserted);
+   }
+
+   /// @return false if no expander answers
+   bool apply(const Transfer &t) {
+      if ( t.chip < base_address or t.chip >= base_address + nb_addresses ) {
+         return false;
+      }
+
+      auto &expander = expanders[t.chip - base_address];
+      uint8_t reg = t.reg;
+
+      if ( expander.nacks ) {
+         --expander.nacks;
+         return false;
+      }
+
+      // Registers work in pairs, the address toggles within the pair
+      for (uint8_t i = 0; i < t.size; ++i, reg ^= 1) {
+         if ( t.write ) {
+            expander.reg[reg] = t.data[i];
+         } else if ( reg < output ) {
+            t.data[i] = expander.captured[reg] = expander.input_port(reg);
+         } else {
+            t.data[i] = expander.reg[reg];
+         }
+      }
+
+      return true;
+   }
+}
+
+namespace asx {
+   namespace i2c {
+      void Master::init(uint32_t) {}
+
+      void Master::write(uint8_t chip, uint8_t reg, const uint8_t *data, uint8_t size, callback_t cb) {
+         alert_and_stop_if(callback != nullptr);
+         pending = Transfer{true, chip, reg, const_cast<uint8_t *>(data), size};
+         callback = cb;
+      }
+
+      void Master::read(uint8_t chip, uint8_t reg, uint8_t *data, uint8_t size, callback_t cb) {
+         alert_and_stop_if(callback != nullptr);
+         pending = Transfer{false, chip, reg, data, size};
+         callback = cb;
+      }
+   }
+}
+
+namespace wcet {
+   namespace i2c {
+      void set_inputs(uint8_t expander, uint8_t value) {
+         expanders[expander].pins[1] = value;
+         update_int();
+      }
+
+      void fail(uint8_t expander, uint8_t transfers) {
+         expanders[expander].nacks = transfers;
+      }
+
+      bool complete() {
+         auto cb = callback;
+
+         if ( cb == nullptr ) {
+            return false;
+         }
+
+         auto status = apply(pending) ? STATUS_OK : ERR_IO_ERROR;
+
+         update_int();
+         callback = nullptr;
+
+         Probe::Measure measure{probe_callback};
+         cb(status);
+
+         return true;
+      }
+   }
+}
@@ -0,0 +1,47 @@
+/**
+ * Benchmark stand-in of the asx ioport
+ * A pin with a pull-up reads high until a stand-in drives it low.
+ */
+#include <asx/ioport.hpp>
+
+#include "wcet.hpp"
+
+namespace {
+   constexpr uint8_t nb_pins = 3 * 8;
+
+   struct State {
+      bool low;
+      bool reacting;
+      asx::reactor::Handle handle;
+   } pins[nb_pins];
+}
+
+namespace asx {
+   namespace ioport {
+      void Pin::init(dir_t, pullup_t) const {}
+
+      bool Pin::get() const {
+         return not pins[pin].low;
+      }
+
+      void Pin::react_on_falling(reactor::Handle handle) const {
+         pins[pin].reacting = true;
+         pins[pin].handle = handle;
+      }
+   }
+}
+
+namespace wcet {
+   namespace ioport {
+      void drive(uint8_t pin, bool level) {
+         auto &state = pins[pin];
+         bool falling = not state.low and not level;
+
+         state.low = not level;
+
+         if ( falling and state.reacting ) {
+            state.handle.notify();
+         }
+      }
+   }
+}
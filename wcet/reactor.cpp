@@ -0,0 +1,108 @@
+/**
+ * Benchmark stand-in of the asx reactor
+ * Pending handlers are dispatched, highest priority first, before the time moves on to the
+ *  next timer due.
+ */
+#include <alert.h>
+#include <asx/reactor.hpp>
+
+#include "wcet.hpp"
+
+namespace {
+   constexpr uint8_t max_handlers = 16;
+
+   struct Slot {
+      asx::reactor::handler_t handler;
+      reactor_priority_t prio;
+      bool pending;
+      bool armed;
+      uint32_t due;    ///< Time the timer is due, in us
+      uint32_t period; ///< Period of a repeating timer, 0 for a single shot
+   };
+
+   Slot slots[max_handlers];
+   uint8_t nb_slots = 0;
+
+   wcet::Probe probe_dispatch{"reactor handler"};
+
+   void arm(uint8_t id, uint32_t delay, uint32_t period) {
+      alert_and_stop_if(id >= nb_slots);
+      slots[id].armed = true;
+      slots[id].due = wcet::now() + delay;
+      slots[id].period = period;
+   }
+}
+
+namespace asx {
+   namespace reactor {
+      void Handle::notify() {
+         alert_and_stop_if(id >= nb_slots);
+         slots[id].pending = true;
+      }
+
+      void Handle::delay(std::chrono::microseconds delay) {
+         arm(id, delay.count(), 0);
+      }
+
+      void Handle::repeat(std::chrono::microseconds period) {
+         arm(id, period.count(), period.count());
+      }
+
+      void Handle::cancel() {
+         alert_and_stop_if(id >= nb_slots);
+         slots[id].armed = false;
+      }
+
+      Handle bind(handler_t handler, reactor_priority_t prio) {
+         alert_and_stop_if(nb_slots == max_handlers);
+         slots[nb_slots] = Slot{handler, prio, false, false, 0, 0};
+         return Handle(nb_slots++);
+      }
+   }
+}
+
+namespace wcet {
+   namespace reactor {
+      bool dispatch() {
+         Slot *next = nullptr;
+
+         for (uint8_t i = 0; i < nb_slots; ++i) {
+            if ( slots[i].pending and (next == nullptr or slots[i].prio > next->prio) ) {
+               next = &slots[i];
+            }
+         }
+
+         if ( next ) {
+            next->pending = false;
+            Probe::Measure measure{probe_dispatch};
+            next->handler();
+         }
+
+         return next != nullptr;
+      }
+
+      uint32_t next_due() {
+         uint32_t due = UINT32_MAX;
+
+         for (uint8_t i = 0; i < nb_slots; ++i) {
+            if ( slots[i].armed and slots[i].due < due ) {
+               due = slots[i].due;
+            }
+         }
+
+         return due;
+      }
+
+      void fire(uint32_t now) {
+         for (uint8_t i = 0; i < nb_slots; ++i) {
+            auto &slot = slots[i];
+
+            if ( slot.armed and slot.due <= now ) {
+               slot.pending = true;
+               slot.armed = slot.period != 0;
+               slot.due += slot.period;
+            }
+         }
+      }
+   }
+}
@@ -0,0 +1,100 @@
+# Flash and static RAM taken by each module, from the linker map of the benchmark
+# The firmware modules (compiled in fw/) are checked against the budgets. The stand-ins, the
+#  benchmark and the libraries are reported apart, as the firmware links others in their place.
+# Usage: awk -v flash_budget=<bytes> -v ram_budget=<bytes> -f size.awk <map>
+
+function hex(s,    n, i) {
+   n = 0
+   s = tolower(s)
+
+   for (i = 3; i <= length(s); ++i) {
+      n = n * 16 + index("0123456789abcdef", substr(s, i, 1)) - 1
+   }
+
+   return n
+}
+
+# The .data is copied from the flash at reset, and takes both
+function add(section, size, file,    module) {
+   module = file
+   sub(/.*\//, "", module)
+   sub(/\(.*/, "", module) # A member of a library is accounted to the library
+
+   if ( section ~ /^\.(text|rodata|progmem|trampolines|vectors|init|fini|ctors|dtors|jumptables)/ ) {
+      flash[module] += size
+   } else if ( section ~ /^\.data/ ) {
+      flash[module] += size
+      ram[module] += size
+   } else if ( section ~ /^(\.bss|\.noinit|COMMON)/ ) {
+      ram[module] += size
+   } else {
+      return
+   }
+
+   if ( !(module in firmware) ) {
+      names[++nb_names] = module
+      firmware[module] = file ~ /(^|\/)fw\//
+   }
+}
+
+# The sections discarded by --gc-sections are listed first
+/^Linker script and memory map/ { linked = 1; next }
+!linked { next }
+
+# An input section on a line, or its long name alone with the rest on the next line
+/^ (\.[^ ]+|COMMON) +0x[0-9a-fA-F]+ +0x[0-9a-fA-F]+ / { add($1, hex($3), $4); pending = ""; next }
+/^ \.[^ ]+$/ { pending = $1; next }
+pending != "" && /^ +0x[0-9a-fA-F]+ +0x[0-9a-fA-F]+ / { add(pending, hex($2), $3) }
+{ pending = "" }
+
+function print_modules(in_firmware,    i, m) {
+   for (i = 1; i <= nb_names; ++i) {
+      m = names[i]
+
+      if ( firmware[m] == in_firmware ) {
+         printf("  %-24s %6u %6u\n", m, flash[m], ram[m])
+         total_flash[in_firmware] += flash[m]
+         total_ram[in_firmware] += ram[m]
+      }
+   }
+}
+
+END {
+   # Sorted by name, for the reports to compare
+   for (i = 2; i <= nb_names; ++i) {
+      for (j = i; j > 1 && names[j - 1] > names[j]; --j) {
+         m = names[j]
+         names[j] = names[j - 1]
+         names[j - 1] = m
+      }
+   }
+
+   printf("Flash and static RAM of the firmware modules (bytes):\n")
+   printf("  %-24s %6s %6s\n", "module", "flash", "ram")
+   print_modules(1)
+   printf("  %-24s %6u %6u\n", "total", total_flash[1], total_ram[1])
+   printf("  %-24s %6u %6u\n", "budget", flash_budget, ram_budget)
+
+   printf("Stand-ins, benchmark and libraries, not budgeted:\n")
+   print_modules(0)
+   printf("  %-24s %6u %6u\n", "total", total_flash[0], total_ram[0])
+
+   exceeded = 0
+
+   if ( total_flash[1] > flash_budget ) {
+      printf("FAIL: the firmware takes %u bytes of flash, budget is %u bytes\n", total_flash[1], flash_budget)
+      ++exceeded
+   }
+
+   if ( total_ram[1] > ram_budget ) {
+      printf("FAIL: the firmware takes %u bytes of static RAM, budget is %u bytes\n", total_ram[1], ram_budget)
+      ++exceeded
+   }
+
+   if ( exceeded ) {
+      printf("%u budget(s) exceeded\n", exceeded)
+      exit 1
+   }
+
+   printf("Flash and RAM budgets met\n")
+}
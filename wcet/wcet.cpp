@@ -0,0 +1,419 @@
+/**
+ * Benchmark core: cycle counter, time, report and entry point
+ * The console is started as the firmware main does, then driven through the scenarios: the
+ *  operator pressing bouncing keys, chords and long presses and flipping the switches, an
+ *  expander failing and being recovered, then the master sending every request the console
+ *  serves. The report goes out on USART0 at 115200 baud, with the deepest stack taken, and the
+ *  benchmark ends in wcet_done, where the simulator breaks.
+ * The report leaves on the alternate TXD of USART0 (PA1), as PB2 is the /INT line of the
+ *  expanders (MUX_INT_PIN). PA1 is the TXD of the RS485 UART, which is a stand-in here.
+ */
+#include <avr/io.h>
+#include <stdio.h>
+
+#include <array>
+#include <string_view>
+#include <utility>
+
+#include <conf_console.h>
+#include <conf_mux.h>
+
+#include "console.hpp"
+#include "mux.hpp"
+#include "tune.hpp"
+#include "wcet.hpp"
+
+using console::Datagram;
+
+/// End of the static data and top of the RAM, from the linker script
+extern uint8_t _end;
+extern uint8_t __stack;
+
+namespace wcet {
+   const char *scenario = "boot";
+
+   namespace {
+      uint32_t clock = 0;
+      uint16_t overhead = 0;
+      Probe *probes = nullptr;
+      FILE output;
+
+      constexpr uint32_t report_baud = 115200;
+
+      int put(char c, FILE *) {
+         while ( not (USART0.STATUS & USART_DREIF_bm) ) {}
+         USART0.TXDATAL = c;
+         return 0;
+      }
+
+      void init_output() {
+         PORTMUX.USARTROUTEA = (PORTMUX.USARTROUTEA & ~PORTMUX_USART0_gm) | PORTMUX_USART0_ALT1_gc;
+         PORTA.DIRSET = PIN1_bm;
+         USART0.BAUD = uint16_t(F_CPU * 64 / (16 * report_baud));
+         USART0.CTRLB = USART_TXEN_bm;
+         fdev_setup_stream(&output, put, nullptr, _FDEV_SETUP_WRITE);
+         stdout = &output;
+      }
+   }
+
+   uint32_t now() {
+      return clock;
+   }
+
+   void run_for(uint32_t us) {
+      auto end = clock + us;
+
+      for (;;) {
+         while ( reactor::dispatch() or i2c::complete() ) {}
+
+         auto due = reactor::next_due();
+
+         if ( due > end ) {
+            break;
+         }
+
+         clock = due;
+         reactor::fire(clock);
+      }
+
+      clock = end;
+   }
+
+   Probe::Probe(const char *name, uint16_t budget) : name{name}, budget{budget}, next{probes} {
+      probes = this;
+   }
+
+   void Probe::init() {
+      // The peripheral clock runs at the CPU clock, see conf_clock.h
+      _PROTECTED_WRITE(CLKCTRL.MCLKCTRLB, 0);
+
+      TCB1.CCMP = 0xFFFF;
+      TCB1.CTRLB = TCB_CNTMODE_INT_gc;
+      TCB1.CTRLA = TCB_CLKSEL_DIV1_gc | TCB_ENABLE_bm;
+
+      // The cost of an empty measure
+      Probe empty{"empty"};
+      overhead = 0xFFFF;
+
+      for (uint8_t i = 0; i < 8; ++i) {
+         { Measure measure{empty}; }
+         overhead = empty.max < overhead ? empty.max : overhead;
+         empty.max = 0;
+      }
+
+      probes = empty.next;
+   }
+
+   Probe::Measure::Measure(Probe &p) : probe{p}, start{TCB1.CNT} {}
+
+   Probe::Measure::~Measure() {
+      uint16_t cycles = TCB1.CNT - start;
+      probe.add(cycles > overhead ? cycles - overhead : 0);
+   }
+
+   uint8_t Probe::report() {
+      uint8_t exceeded = 0;
+
+      printf("Cycles of the firmware hot paths (%lu MHz):\n", F_CPU / 1000000);
+      printf("  %-24s %6s %6s %6s %6s  %s\n", "path", "count", "mean", "max", "budget", "worst case");
+
+      for (auto p = probes; p; p = p->next) {
+         auto mean = p->count ? p->total / p->count : 0;
+
+         printf("  %-24s %6u %6lu %6u %6u  %s\n",
+            p->name, p->count, mean, p->max, p->budget, p->worst ? p->worst : "-");
+
+         if ( p->budget and p->max > p->budget ) {
+            printf("FAIL: %s takes %u cycles, budget is %u cycles\n", p->name, p->max, p->budget);
+            ++exceeded;
+         }
+      }
+
+      return exceeded;
+   }
+
+   namespace stack {
+      namespace {
+         /// Unlikely as a return address or a saved register
+         constexpr uint8_t paint_value = 0xC5;
+      }
+
+      void paint() {
+         // Only the frames of this function and its callers are above the stack pointer. The
+         //  writes are volatile for the loop not to become a call to memset.
+         for (volatile uint8_t *p = &_end; p <= (uint8_t *)SP; ++p) {
+            *p = paint_value;
+         }
+      }
+
+      bool report() {
+         auto p = &_end;
+
+         while ( p <= &__stack and *p == paint_value ) {
+            ++p;
+         }
+
+         uint16_t used = &__stack - p + 1;
+         uint16_t free = &__stack - &_end + 1;
+
+         printf("Stack: %u bytes at most, of %u bytes left by the static data, budget %u\n",
+            used, free, uint16_t(WCET_STACK));
+
+         if ( used > WCET_STACK ) {
+            printf("FAIL: the stack takes %u bytes, budget is %u bytes\n", used, uint16_t(WCET_STACK));
+            return true;
+         }
+
+         return false;
+      }
+   }
+
+   void alert(const char *file, int line) {
+      printf("ALERT %s:%d in %s\n", file, line, scenario);
+      wcet_done();
+   }
+}
+
+namespace {
+   using namespace wcet;
+
+   /// Idle inputs: no key, the switches off (active low) on the right
+   constexpr uint8_t left_idle = 0x00;
+   constexpr uint8_t right_idle = 0x0F;
+
+   /// Inputs of the operator scenarios, each held until the keys are stable
+   struct Inputs {
+      const char *name;
+      uint8_t left;
+      uint8_t right;
+   };
+
+   const Inputs operator_steps[] = {
+      {"key press", 0x01, right_idle},
+      {"key release", left_idle, right_idle},
+      {"shift press", left_idle, right_idle | 0x20},
+      {"shifted key press", 0x04, right_idle | 0x20},
+      {"shifted key release", left_idle, right_idle},
+      {"two keys press", 0x03, right_idle},
+      {"two keys release", left_idle, right_idle},
+      {"chord press", 0x0C, right_idle},
+      {"chord release", left_idle, right_idle},
+      {"door key press", left_idle, right_idle | 0x10},
+      {"door key release", left_idle, right_idle},
+      {"switches on", left_idle, 0x00},
+      {"switches off", left_idle, right_idle},
+      {"all inputs", 0x3F, 0x30},
+      {"all released", left_idle, right_idle},
+   };
+
+   constexpr uint32_t bounce_us = 1000;
+   constexpr uint32_t bounce_step_us = 100;
+   constexpr uint32_t settle_us = 20000;
+
+   /// @brief Change the inputs, bouncing before they settle
+   void press(uint8_t left, uint8_t right) {
+      static uint8_t last_left = left_idle;
+      static uint8_t last_right = right_idle;
+
+      for (uint32_t t = 0; t < bounce_us; t += bounce_step_us) {
+         bool flip = (t / bounce_step_us) % 2;
+
+         i2c::set_inputs(0, flip ? left : last_left);
+         i2c::set_inputs(1, flip ? right : last_right);
+         run_for(bounce_step_us);
+      }
+
+      i2c::set_inputs(0, last_left = left);
+      i2c::set_inputs(1, last_right = right);
+      run_for(settle_us);
+   }
+
+   void run_operator() {
+      for (auto &step : operator_steps) {
+         scenario = step.name;
+         press(step.left, step.right);
+      }
+
+      // Held until it repeats, then tapped again for a double press
+      scenario = "long press";
+      press(0x01, right_idle);
+      run_for((MUX_LONG_PRESS_MS + 2 * MUX_REPEAT_MS) * 1000UL);
+      press(left_idle, right_idle);
+      scenario = "double press";
+      press(0x01, right_idle);
+      press(left_idle, right_idle);
+
+      // More events than the queue holds, the oldest are dropped
+      scenario = "key events overflow";
+
+      for (uint8_t i = 0; i < MUX_KEY_EVENTS; ++i) {
+         press(0x02, right_idle);
+         press(left_idle, right_idle);
+      }
+
+      // The right expander misses a cycle and its first recovery, and is put back in service on retry
+      scenario = "i2c fault";
+      i2c::fail(1, 2);
+      press(0x01, right_idle);
+      press(left_idle, right_idle);
+      run_for(MUX_RECOVERY_RETRY_MS * 1000UL);
+   }
+
+   constexpr uint8_t device = CONSOLE_DEFAULT_ADDRESS;
+
+   /// A request of the master, from the function code
+   struct Request {
+      const char *name;
+      uint8_t address;
+      uint8_t size;
+      uint8_t pdu[72];
+   };
+
+   /// Upload of a full tune, the longest frame served
+   constexpr Request tune_upload() {
+      Request r{"16 write tune", device, 6 + 64, {16, 0, 43, 0, 32, 64}};
+
+      for (uint8_t i = 0; i < 32; ++i) {
+         r.pdu[6 + 2 * i] = 60;
+         r.pdu[7 + 2 * i] = 1;
+      }
+
+      return r;
+   }
+
+   const Request requests[] = {
+      {"101 custom", device, 3, {101, 0x0F, 0xFF}},
+      {"102 wait change", device, 5, {102, 0x0F, 0xFF, 0, 10}},
+      {"01 read coils", device, 5, {1, 0, 0, 0, 12}},
+      {"01 bad address", device, 5, {1, 0, 200, 0, 1}},
+      {"02 read switches", device, 5, {2, 0, 0, 0, 4}},
+      {"04 read inputs", device, 5, {4, 0, 0, 0, 25}},
+      {"03 read holding", device, 5, {3, 0, 0, 0, 78}},
+      {"05 write coil", device, 5, {5, 0, 3, 0xFF, 0}},
+      {"15 write coils", device, 8, {15, 0, 0, 0, 12, 2, 0x55, 0x05}},
+      {"15 broadcast", 0, 8, {15, 0, 0, 0, 12, 2, 0xAA, 0x0A}},
+      {"06 buzzer", device, 5, {6, 0, 10, 0, 1}},
+      {"06 effect", device, 5, {6, 0, 18, 0x45, 0x00}}, // Blink every 10 ticks
+      {"06 brightness", device, 5, {6, 0, 30, 0, 7}},
+      {"08 diagnostics", device, 5, {8, 0, 0x0B, 0, 0}},
+      {"23 read write", device, 14, {23, 0, 11, 0, 7, 0, 10, 0, 2, 4, 0, 1, 0x0F, 0xFF}},
+      tune_upload(),
+      {"24 key events", device, 3, {24, 0, 0}},
+      {"other node", device + 1, 3, {101, 0x0F, 0xFF}},
+      {"06 line rate", device, 5, {6, 0, 76, 0, 0}},
+      {"06 slave address", device, 5, {6, 0, 75, 0, device + 1}},
+   };
+
+   constexpr auto nb_requests = sizeof(requests) / sizeof(requests[0]);
+
+   /// The reply is ready once the frame is complete, within a T3.5
+   template<size_t... I>
+   auto make_probes(std::index_sequence<I...>) {
+      return std::array<Probe, nb_requests>{Probe{requests[I].name, frame_budget}...};
+   }
+
+   auto reply_probes = make_probes(std::make_index_sequence<nb_requests>{});
+
+   Probe probe_char{"process_char", char_budget};
+   Probe probe_bad_crc{"bad crc", frame_budget};
+
+   /// @brief Receive a frame a character at a time, then ready the reply
+   void receive(const uint8_t *frame, uint16_t size, Probe &reply) {
+      for (uint16_t i = 0; i < size; ++i) {
+         Probe::Measure measure{probe_char};
+         Datagram::process_char(frame[i]);
+      }
+
+      {
+         Probe::Measure measure{reply};
+
+         if ( Datagram::get_status() == Datagram::status_t::GOOD_FRAME ) {
+            Datagram::ready_reply();
+         }
+      }
+
+      Datagram::reset();
+   }
+
+   /// @return The size of the frame, with its address and CRC
+   uint8_t make_frame(const Request &r, uint8_t *frame) {
+      console::Crc crc;
+      uint8_t size = 0;
+
+      frame[size++] = r.address;
+
+      for (uint8_t i = 0; i < r.size; ++i) {
+         frame[size++] = r.pdu[i];
+      }
+
+      crc.update(std::string_view{(const char *)frame, size});
+      frame[size++] = crc.get() & 0xFF;
+      frame[size++] = crc.get() >> 8;
+
+      return size;
+   }
+
+   void run_master() {
+      uint8_t frame[260]; // Longer than the buffer of the datagram
+
+      for (uint8_t i = 0; i < nb_requests; ++i) {
+         scenario = requests[i].name;
+         receive(frame, make_frame(requests[i], frame), reply_probes[i]);
+
+         // The handlers the request triggered, like the LED writes
+         run_for(settle_us);
+      }
+
+      // The slave address changed last
+      scenario = "bad crc";
+      auto size = make_frame(requests[0], frame);
+      frame[0] = device + 1;
+      frame[size - 1] ^= 0xFF;
+      receive(frame, size, probe_bad_crc);
+
+      // Longer than the buffer, only the CRC matters
+      scenario = "overflow";
+
+      for (auto &c : frame) {
+         c = 0x55;
+      }
+
+      frame[0] = device + 1;
+      receive(frame, sizeof(frame), probe_bad_crc);
+   }
+}
+
+extern "C" __attribute__((noinline, used)) void wcet_done() {
+   for (;;) {}
+}
+
+int main() {
+   stack::paint();
+   init_output();
+   Probe::init();
+
+   printf("\nWCET of the console, keeping up with %lu baud\n", WCET_BAUD);
+
+   console::init();
+   console::mux::init();
+   console::tune::init();
+   run_for(settle_us);
+
+   run_operator();
+   run_master();
+
+   // The LEDs blink, flash and dim as the requests set them
+   scenario = "effects";
+   run_for(1000000);
+
+   auto exceeded = Probe::report();
+   exceeded += stack::report();
+
+   if ( exceeded ) {
+      printf("%u budget(s) exceeded\n", exceeded);
+   } else {
+      printf("All budgets met\n");
+   }
+
+   wcet_done();
+}
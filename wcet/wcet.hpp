@@ -0,0 +1,140 @@
+#pragma once
+/**
+ * Cycle counts of the firmware hot paths on the ATtiny3224
+ * The firmware sources are compiled for the target against the stand-ins found in standin/include,
+ *  and run on the instruction-set simulator of MPLAB X (or on a board).
+ * Each path is measured with TCB1 counting the peripheral clock, which runs undivided at the
+ *  CPU clock, so a count is a number of CPU cycles. The overhead of the measure is subtracted.
+ * The stand-ins replace the hardware and the time, which only moves as the benchmark advances
+ *  it, so the paths run the same from a build to the next.
+ * The free RAM is painted at the start, so the deepest stack the scenarios took shows at the end.
+ */
+#include <stdint.h>
+
+/// CPU clock (see conf_clock.h), the budgets are converted to cycles with it
+#ifndef F_CPU
+#  define F_CPU 20000000UL
+#endif
+
+/// Line rate to keep up with. A character must be processed within its own time on the line.
+#ifndef WCET_BAUD
+#  define WCET_BAUD 1000000UL
+#endif
+
+/// Time for the reply to be ready once the frame is complete (us), the T3.5 above 19200 baud
+#ifndef WCET_FRAME_US
+#  define WCET_FRAME_US 1750UL
+#endif
+
+/// Time an I2C completion may hold the reactor (us), a quarter of the input poll period
+#ifndef WCET_I2C_US
+#  define WCET_I2C_US 500UL
+#endif
+
+/// Stack the firmware may take at most (bytes), what the RAM leaves once its static data is placed
+#ifndef WCET_STACK
+#  define WCET_STACK 512UL
+#endif
+
+/// @brief End of the benchmark, where the simulator breaks once the report is out
+extern "C" [[noreturn]] void wcet_done();
+
+namespace wcet {
+   /// Budgets in cycles, 0 for none
+   constexpr uint16_t char_budget = F_CPU * 11 / WCET_BAUD; // 8E1 with the start and stop bits
+   constexpr uint16_t frame_budget = F_CPU / 1000 * WCET_FRAME_US / 1000;
+   constexpr uint16_t i2c_budget = F_CPU / 1000 * WCET_I2C_US / 1000;
+
+   static_assert(F_CPU / 1000 * WCET_FRAME_US / 1000 < 0x10000, "The frame budget must fit the 16 bits counter");
+   static_assert(F_CPU / 1000 * WCET_I2C_US / 1000 < 0x10000, "The I2C budget must fit the 16 bits counter");
+
+   /// @return The time since power-up in us, as the benchmark advanced it
+   uint32_t now();
+
+   /// @brief Dispatch the handlers, complete the I2C transfers and fire the timers for a time
+   void run_for(uint32_t us);
+
+   /// Case being run, reported against the worst count of each path
+   extern const char *scenario;
+
+   /// @brief Report a fatal firmware alert and stop
+   [[noreturn]] void alert(const char *file, int line);
+
+   /// @brief Cycles taken by a firmware hot path
+   class Probe {
+      const char *name;
+      uint16_t budget;
+      uint16_t count = 0;
+      uint32_t total = 0;
+      uint16_t max = 0;
+      const char *worst = nullptr; ///< Scenario of the max
+      Probe *next;
+
+   public:
+      /// @param budget Optional budget for the max count, checked in the report
+      explicit Probe(const char *name, uint16_t budget = 0);
+
+      void add(uint16_t cycles) {
+         ++count;
+         total += cycles;
+
+         if ( cycles > max ) {
+            max = cycles;
+            worst = scenario;
+         }
+      }
+
+      /// @brief Print all probes and check their budget
+      /// @return The number of budgets exceeded
+      static uint8_t report();
+
+      /// @brief Start the cycle counter, and measure its overhead
+      static void init();
+
+      /// RAII measure of a scope
+      class Measure {
+         Probe &probe;
+         uint16_t start;
+      public:
+         explicit Measure(Probe &p);
+         ~Measure();
+      };
+   };
+
+   /// Deepest stack, found from the RAM left unwritten since it was painted
+   namespace stack {
+      /// @brief Paint the free RAM, from the end of the static data to the stack pointer
+      void paint();
+      /// @brief Print the bytes of stack taken at most and check the budget
+      /// @return true if over the budget
+      bool report();
+   }
+
+   /// The I/O expanders, their /INT outputs wired together to MUX_INT_PIN
+   namespace i2c {
+      /// @brief Drive the input port of an expander
+      void set_inputs(uint8_t expander, uint8_t value);
+      /// @brief Leave the next transfers to an expander unanswered
+      void fail(uint8_t expander, uint8_t transfers);
+      /// @brief Complete the transfer in progress
+      /// @return false if none
+      bool complete();
+   }
+
+   /// MCU pins driven by the stand-ins
+   namespace ioport {
+      /// @brief Drive a pin, as an open drain output would
+      void drive(uint8_t pin, bool level);
+   }
+
+   /// Handlers and timers of the reactor
+   namespace reactor {
+      /// @brief Dispatch the highest priority pending handler
+      /// @return false if none is pending
+      bool dispatch();
+      /// @return Time of the next timer due, or UINT32_MAX if none is armed
+      uint32_t next_due();
+      /// @brief Mark the handlers of the timers due as pending
+      void fire(uint32_t now);
+   }
+}